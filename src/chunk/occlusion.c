@@ -0,0 +1,38 @@
+#include "occlusion.h"
+#include "chunk.h"
+#include "triangulate.h"
+#include "linalg/vector.h"
+
+#include <assert.h>
+
+void mcc_chunk_draw_occluders(struct mcc_occlusion_buffer *r_buffer, const struct mcc_chunk_render_object *r_object) {
+    const struct mcc_chunk_mesh *mesh = r_object->mesh;
+    assert(mesh->index_count % 6 == 0);
+
+    // Each quad is made of 6 indices, see `struct mcc_chunk_mesh`
+    for (size_t index_i = 0; index_i < mesh->index_count; index_i += 6) {
+        const uint32_t *indices = &mesh->indices[index_i];
+        // Corner shared by the quad's first triangle edges
+        const mcc_vec3f p0 = mesh->positions[indices[0]],
+                        e1 = mcc_vec3f_sub(mesh->positions[indices[1]], p0),
+                        e2 = mcc_vec3f_sub(mesh->positions[indices[2]], p0);
+        if (mcc_vec3f_norm(mcc_vec3f_cross(e1, e2)) < MCC_CHUNK_OCCLUDER_MIN_AREA)
+            continue;
+
+        // Same culling as `mcc_chunk_render_config`, back faces must not
+        // hide what is behind them as they are not rendered
+        mcc_occlusion_buffer_draw_occluders(
+            r_buffer, r_object->mvp, MCC_CPURAST_CULLING_MODE_CW,
+            mesh->positions, indices, 6
+        );
+    }
+}
+
+bool mcc_chunk_test_visibility(const struct mcc_occlusion_buffer *r_buffer, const struct mcc_chunk_render_object *r_object) {
+    // Meshes are in the chunk's local coordinates
+    return mcc_occlusion_buffer_test_aabb(
+        r_buffer, r_object->mvp,
+        (mcc_vec3f){{ 0.f, 0.f, 0.f }},
+        (mcc_vec3f){{ MCC_CHUNK_WIDTH, MCC_CHUNK_WIDTH, MCC_CHUNK_WIDTH }}
+    );
+}
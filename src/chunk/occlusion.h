@@ -0,0 +1,23 @@
+#pragma once
+
+#include "chunk/shader.h"
+#include "cpu_rasterizer/occlusion.h"
+
+/**
+ * Minimum area (in blocks) of the faces of a chunk mesh drawn as occluders,
+ * smaller faces rarely hide anything and are not worth drawing.
+ */
+#define MCC_CHUNK_OCCLUDER_MIN_AREA 4.f
+
+/**
+ * Draws the big faces of the chunk's mesh in the occlusion buffer.
+ */
+void mcc_chunk_draw_occluders(struct mcc_occlusion_buffer *r_buffer, const struct mcc_chunk_render_object *r_object);
+
+/**
+ * Returns false if the chunk is known to be hidden by the occluders of the
+ * buffer (or outside of the view), in which case it does not need to be
+ * rendered.
+ * A chunk can never be hidden by its own occluders.
+ */
+bool mcc_chunk_test_visibility(const struct mcc_occlusion_buffer *r_buffer, const struct mcc_chunk_render_object *r_object);
@@ -3,12 +3,16 @@
 #include "cpu_rasterizer/cpu_rasterizer.h"
 #include "triangulate.h"
 #include "linalg/vector.h"
+#include "linalg/matrix.h"
+#include "linalg/simd.h"
 #include "linalg/scalars.h"
 #include "images/ppm.h"
 #include "safe_cast.h"
+#include "utils.h"
 
 #include <stddef.h>
 #include <math.h>
+#include <stdbit.h>
 #include <stdlib.h>
 
 /**
@@ -89,8 +93,11 @@ struct mcc_chunk_render_data *mcc_chunk_render_data_load() {
 }
 
 mcc_vec4f sample(mcc_image_t *image, mcc_vec2f texcoords) {
-    size_t x = (size_t)((float)image->width * fmodf(texcoords.x, 1.f)) % image->width;
-    size_t y = (size_t)((float)image->height * (1.f - fmodf(texcoords.y, 1.f))) % image->height;
+    // NOTE: Same as fmodf(coord, 1.f) (both are exact) without the libm call
+    float fract_x = texcoords.x - truncf(texcoords.x),
+          fract_y = texcoords.y - truncf(texcoords.y);
+    size_t x = (size_t)((float)image->width * fract_x) % image->width;
+    size_t y = (size_t)((float)image->height * (1.f - fract_y)) % image->height;
     assert(x < image->width);
     assert(y < image->height);
     size_t idx = x + y * image->width;
@@ -141,85 +148,184 @@ void mcc_chunk_vertex_shader_fn(struct mcc_cpurast_vertex_shader_input *input) {
     }};
 }
 
-void mcc_chunk_fragment_shader_fn(struct mcc_cpurast_fragment_shader_input *input) {
+static_assert(MCC_CPURAST_VERTEX_BATCH_SIZE == MCC_SIMD_WIDTH);
+
+void mcc_chunk_vertex_shader_position_batch_fn(struct mcc_cpurast_vertex_batch_input *input) {
     struct mcc_chunk_render_object *render_object = input->o_in_data;
-    struct mcc_chunk_render_data *render_data = render_object->data;
+    struct mcc_chunk_mesh *mesh = render_object->mesh;
 
-    uint8_t block_type = (uint8_t)input->r_in_varyings[0].vec4f.x;
-    mcc_vec3f normal = input->r_in_varyings[1].vec4f.xyz;
-    mcc_vec2f texcoords = input->r_in_varyings[2].vec4f.xy;
-    enum mcc_chunk_block_faces face = input->r_in_varyings[3].vec4f.x;
+    // Gather the positions in structure of arrays form, repeating the last
+    // vertex in the unused lanes
+    float positions[3][MCC_SIMD_WIDTH];
+    for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+        mcc_vec3f position = mesh->positions[input->in_vertex_indices[mcc_min(lane, input->in_vertex_count - 1)]];
+        positions[0][lane] = position.x;
+        positions[1][lane] = position.y;
+        positions[2][lane] = position.z;
+    }
+
+    // Transform vertex positions
+    mcc_mat4f_mul_points_soa(render_object->mvp, positions, input->out_position);
+}
+
+void mcc_chunk_vertex_shader_batch_fn(struct mcc_cpurast_vertex_batch_input *input) {
+    struct mcc_chunk_render_object *render_object = input->o_in_data;
+    struct mcc_chunk_mesh *mesh = render_object->mesh;
+
+    mcc_chunk_vertex_shader_position_batch_fn(input);
 
+    for (uint32_t lane = 0; lane < input->in_vertex_count; lane++) {
+        size_t vertex_idx = input->in_vertex_indices[lane];
+        mcc_vec3f normal = mesh->normals[vertex_idx];
+        mcc_vec2f texcoords = mesh->texcoords[vertex_idx];
+
+        // Same varyings as mcc_chunk_vertex_shader_fn
+        input->r_out_varyings[0][0][lane] = (float)mesh->texids[vertex_idx] + 0.5f;
+        input->r_out_varyings[0][1][lane] = 0.f;
+        input->r_out_varyings[0][2][lane] = 0.f;
+        input->r_out_varyings[0][3][lane] = 0.f;
+
+        input->r_out_varyings[1][0][lane] = normal.x;
+        input->r_out_varyings[1][1][lane] = normal.y;
+        input->r_out_varyings[1][2][lane] = normal.z;
+        input->r_out_varyings[1][3][lane] = 0.f;
+
+        input->r_out_varyings[2][0][lane] = texcoords.u;
+        input->r_out_varyings[2][1][lane] = texcoords.v;
+        input->r_out_varyings[2][2][lane] = 0.f;
+        input->r_out_varyings[2][3][lane] = 0.f;
+
+        input->r_out_varyings[3][0][lane] = (float)mesh->faces[vertex_idx] + 0.5f;
+        input->r_out_varyings[3][1][lane] = 0.f;
+        input->r_out_varyings[3][2][lane] = 0.f;
+        input->r_out_varyings[3][3][lane] = 0.f;
+    }
+}
+
+/**
+ * Texture of the given face of a block, NULL for unknown blocks.
+ */
+static mcc_image_t *block_face_texture(struct mcc_chunk_render_data *render_data, uint8_t block_type, enum mcc_chunk_block_faces face) {
     switch (block_type) {
         case MCC_BLOCK_TYPE_STONE:
-            input->out_color = sample(&render_data->stone_texture, texcoords);
-            break;
+            return &render_data->stone_texture;
         case MCC_BLOCK_TYPE_DIRT:
-            input->out_color = sample(&render_data->dirt_texture, texcoords);
-            break;
-        case MCC_BLOCK_TYPE_GRASS: {
-            mcc_image_t *texture;
+            return &render_data->dirt_texture;
+        case MCC_BLOCK_TYPE_GRASS:
             switch (face) {
             case BLOCK_FACE_NX:
             case BLOCK_FACE_PX:
             case BLOCK_FACE_NZ:
             case BLOCK_FACE_PZ:
-                texture = &render_data->grass_block_side_texture;
-                break;
+                return &render_data->grass_block_side_texture;
             case BLOCK_FACE_NY:
-                texture = &render_data->dirt_texture;
-                break;
+                return &render_data->dirt_texture;
             case BLOCK_FACE_PY:
-                texture = &render_data->grass_block_top_texture;
-                break;
+                return &render_data->grass_block_top_texture;
             }
-            input->out_color = sample(texture, texcoords);
-            break;
-        }
-        case MCC_BLOCK_TYPE_LOG: {
-            mcc_image_t *texture;
+            return NULL;
+        case MCC_BLOCK_TYPE_LOG:
             switch (face) {
             case BLOCK_FACE_NX:
             case BLOCK_FACE_PX:
             case BLOCK_FACE_NZ:
             case BLOCK_FACE_PZ:
-                texture = &render_data->oak_log_texture;
-                break;
+                return &render_data->oak_log_texture;
             case BLOCK_FACE_NY:
             case BLOCK_FACE_PY:
-                texture = &render_data->oak_log_top_texture;
-                break;
+                return &render_data->oak_log_top_texture;
             }
-            input->out_color = sample(texture, texcoords);
-            break;
-        }
+            return NULL;
         case MCC_BLOCK_TYPE_LEAVES:
-            input->out_color = sample(&render_data->oak_leaves_texture, texcoords);
-            break;
+            return &render_data->oak_leaves_texture;
         default:
-            input->out_color = (mcc_vec4f){{ 1.0f, 0.0f, 1.0f, 1.0f }}; // Magenta for unknown
-            break;
+            return NULL;
     }
+}
 
-    mcc_vec3f strong_light_dir = mcc_vec3f_normalized((mcc_vec3f){{ 1.f, 2.5f, -1.5f }});
-    mcc_vec3f soft_light_dir = mcc_vec3f_scale(strong_light_dir, -1.f);
+/**
+ * Color of unknown blocks
+ */
+static const mcc_vec4f unknown_block_color = {{ 1.0f, 0.0f, 1.0f, 1.0f }}; // Magenta
 
-    float strong_diffuse = clampf(mcc_vec3f_dot(normal, strong_light_dir), 0.f, 1.f);
-    float soft_diffuse = clampf(mcc_vec3f_dot(normal, soft_light_dir), 0.f, 1.f);
+/**
+ * Direction the strong light comes from, a soft light comes from the
+ * opposite direction.
+ */
+static mcc_vec3f strong_light_direction() {
+    return mcc_vec3f_normalized((mcc_vec3f){{ 1.f, 2.5f, -1.5f }});
+}
+
+/**
+ * Light intensity factor of a surface with the given normal.
+ */
+static inline float light_factor(mcc_vec3f strong_light_dir, float normal_x, float normal_y, float normal_z) {
+    float strong_dot = normal_x * strong_light_dir.x + normal_y * strong_light_dir.y + normal_z * strong_light_dir.z;
+    float strong_diffuse = clampf(strong_dot, 0.f, 1.f);
+    float soft_diffuse = clampf(-strong_dot, 0.f, 1.f);
     float ambient = 0.25f;
-    float cf = clampf(strong_diffuse + soft_diffuse * 0.15f + ambient, 0.f, 1.f);
+    return clampf(strong_diffuse + soft_diffuse * 0.15f + ambient, 0.f, 1.f);
+}
+
+void mcc_chunk_fragment_shader_fn(struct mcc_cpurast_fragment_shader_input *input) {
+    struct mcc_chunk_render_object *render_object = input->o_in_data;
+    struct mcc_chunk_render_data *render_data = render_object->data;
+
+    uint8_t block_type = (uint8_t)input->r_in_varyings[0].vec4f.x;
+    mcc_vec3f normal = input->r_in_varyings[1].vec4f.xyz;
+    mcc_vec2f texcoords = input->r_in_varyings[2].vec4f.xy;
+    enum mcc_chunk_block_faces face = input->r_in_varyings[3].vec4f.x;
+
+    mcc_image_t *texture = block_face_texture(render_data, block_type, face);
+    input->out_color = texture ? sample(texture, texcoords) : unknown_block_color;
+
+    float cf = light_factor(strong_light_direction(), normal.x, normal.y, normal.z);
 
     input->out_color = mcc_vec4f_scale(input->out_color, cf);
     input->out_color.a = 1.f;
 }
 
+void mcc_chunk_fragment_shader_packet_fn(struct mcc_cpurast_fragment_packet_input *input) {
+    struct mcc_chunk_render_object *render_object = input->o_in_data;
+    struct mcc_chunk_render_data *render_data = render_object->data;
+
+    const float *normals_x = input->r_in_varyings[1][0],
+                *normals_y = input->r_in_varyings[1][1],
+                *normals_z = input->r_in_varyings[1][2];
+
+    const mcc_vec3f strong_light_dir = strong_light_direction();
+    float cfs[MCC_CPURAST_FRAGMENT_PACKET_SIZE];
+    for (uint32_t lane = 0; lane < MCC_CPURAST_FRAGMENT_PACKET_SIZE; lane++)
+        cfs[lane] = light_factor(strong_light_dir, normals_x[lane], normals_y[lane], normals_z[lane]);
+
+    // Texture sampling is a gather anyway, only done for active fragments
+    for (uint32_t mask = input->in_active_mask; mask; mask &= mask - 1) {
+        const uint32_t lane = stdc_trailing_zeros(mask);
+
+        uint8_t block_type = (uint8_t)input->r_in_varyings[0][0][lane];
+        mcc_vec2f texcoords = {{ input->r_in_varyings[2][0][lane], input->r_in_varyings[2][1][lane] }};
+        enum mcc_chunk_block_faces face = input->r_in_varyings[3][0][lane];
+
+        mcc_image_t *texture = block_face_texture(render_data, block_type, face);
+        mcc_vec4f color = texture ? sample(texture, texcoords) : unknown_block_color;
+
+        input->out_color[0][lane] = color.r * cfs[lane];
+        input->out_color[1][lane] = color.g * cfs[lane];
+        input->out_color[2][lane] = color.b * cfs[lane];
+        input->out_color[3][lane] = 1.f;
+    }
+}
+
 void mcc_chunk_vertex_shader(struct mcc_vertex_shader *out_shader) {
     out_shader->r_fn = mcc_chunk_vertex_shader_fn;
+    out_shader->o_batch_fn = mcc_chunk_vertex_shader_batch_fn;
+    out_shader->o_position_batch_fn = mcc_chunk_vertex_shader_position_batch_fn;
     out_shader->varying_count = MCC_CHUNK_SHADER_VARYING_COUNT;
 }
 
 void mcc_chunk_fragment_shader(struct mcc_fragment_shader *out_shader) {
     out_shader->r_fn = mcc_chunk_fragment_shader_fn;
+    out_shader->o_packet_fn = mcc_chunk_fragment_shader_packet_fn;
     out_shader->varying_count = MCC_CHUNK_SHADER_VARYING_COUNT;
 }
 
@@ -229,6 +335,10 @@ void mcc_chunk_render_config(
     struct mcc_cpurast_rendering_attachment *attachment
 ) {
     out_config->r_attachment = attachment;
+    out_config->o_context = NULL;
+    // The whole attachment
+    out_config->viewport = (struct mcc_cpurast_rect){};
+    out_config->scissor = (struct mcc_cpurast_rect){};
     
     out_config->o_vertex_shader_data = render_object;
     struct mcc_vertex_shader *vs = malloc(sizeof(struct mcc_vertex_shader));
@@ -238,21 +348,27 @@ void mcc_chunk_render_config(
     out_config->o_fragment_shader_data = render_object;
     struct mcc_fragment_shader *fs = malloc(sizeof(struct mcc_fragment_shader));
     mcc_chunk_fragment_shader(fs);
-    out_config->r_fragment_shader = fs;
+    out_config->o_fragment_shader = fs;
     
     out_config->culling_mode = MCC_CPURAST_CULLING_MODE_CW;
     out_config->o_depth_comparison_fn = mcc_depth_comparison_fn_lt;
     out_config->polygon_mode = MCC_CPURAST_POLYGON_MODE_FILL;
+    out_config->shading_mode = MCC_CPURAST_SHADING_MODE_FORWARD;
     
-    out_config->vertex_count = safe_to_u32(render_object->mesh->vertex_count);
+    out_config->first_vertex = 0;
+    out_config->vertex_count = safe_to_u32(render_object->mesh->index_count);
+    out_config->o_indices = render_object->mesh->indices;
     out_config->vertex_processing = MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_LIST;
+
+    out_config->o_statistics = NULL;
+    out_config->o_tile_mask = NULL;
 }
 
 void mcc_chunk_render_config_cleanup(struct mcc_cpurast_render_config *config) {
     if (config->r_vertex_shader) {
         free((void*)config->r_vertex_shader);
     }
-    if (config->r_fragment_shader) {
-        free((void*)config->r_fragment_shader);
+    if (config->o_fragment_shader) {
+        free((void*)config->o_fragment_shader);
     }
 }
@@ -16,7 +16,10 @@ struct mcc_chunk_render_data *mcc_chunk_render_data_load();
 void mcc_chunk_render_data_free(struct mcc_chunk_render_data *);
 
 void mcc_chunk_vertex_shader_fn(struct mcc_cpurast_vertex_shader_input *input);
+void mcc_chunk_vertex_shader_batch_fn(struct mcc_cpurast_vertex_batch_input *input);
+void mcc_chunk_vertex_shader_position_batch_fn(struct mcc_cpurast_vertex_batch_input *input);
 void mcc_chunk_fragment_shader_fn(struct mcc_cpurast_fragment_shader_input *input);
+void mcc_chunk_fragment_shader_packet_fn(struct mcc_cpurast_fragment_packet_input *input);
 
 void mcc_chunk_vertex_shader(struct mcc_vertex_shader *out_shader);
 void mcc_chunk_fragment_shader(struct mcc_fragment_shader *out_shader);
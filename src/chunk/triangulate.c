@@ -1,6 +1,7 @@
 #include "triangulate.h"
 #include "chunk/chunk.h"
 #include "defs.h"
+#include "safe_cast.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +15,9 @@ void mcc_chunk_mesh_init(struct mcc_chunk_mesh *r_mesh) {
     r_mesh->texcoords = NULL;
     r_mesh->texids = NULL;
     r_mesh->faces = NULL;
+    r_mesh->index_count = 0;
+    r_mesh->index_capacity = 0;
+    r_mesh->indices = NULL;
 }
 
 void mcc_chunk_mesh_free(struct mcc_chunk_mesh *r_mesh) {
@@ -22,6 +26,7 @@ void mcc_chunk_mesh_free(struct mcc_chunk_mesh *r_mesh) {
     free(r_mesh->texcoords);
     free(r_mesh->texids);
     free(r_mesh->faces);
+    free(r_mesh->indices);
 
     r_mesh->vertex_count = 0;
     r_mesh->vertex_capacity = 0;
@@ -30,6 +35,9 @@ void mcc_chunk_mesh_free(struct mcc_chunk_mesh *r_mesh) {
     r_mesh->texcoords = NULL;
     r_mesh->texids = NULL;
     r_mesh->faces = NULL;
+    r_mesh->index_count = 0;
+    r_mesh->index_capacity = 0;
+    r_mesh->indices = NULL;
 }
 
 /**
@@ -54,51 +62,50 @@ static void add_vertices(struct mcc_chunk_mesh *r_mesh, size_t amount) {
     r_mesh->vertex_count += amount;
 }
 
+/**
+ * Increment the index_count and allocate required additional capacity.
+ */
+static void add_indices(struct mcc_chunk_mesh *r_mesh, size_t amount) {
+    size_t new_cap = r_mesh->index_capacity;
+    if (new_cap == 0)
+        new_cap = 8;
+    while (new_cap < r_mesh->index_count + amount)
+        new_cap *= 2;
+
+    if (r_mesh->index_capacity < new_cap) {
+        r_mesh->index_capacity = new_cap;
+        r_mesh->indices = realloc(r_mesh->indices, sizeof(*r_mesh->indices) * new_cap);
+    }
+
+    r_mesh->index_count += amount;
+}
+
 struct face_mesh {
     struct mcc_chunk_mesh *r_mesh;
     size_t start_idx;
+    size_t start_index_idx;
     float32_t x, y, z;
     float32_t extent_x, extent_y, extent_z;
     bool swap_winding;
 };
 
 /**
- * Swap vertices to change triangle winding order
+ * Writes the indices of the two triangles of the quad made of the 4
+ * vertices starting at `start_idx`, the vertices 1 and 2 being on the
+ * shared diagonal.
  */
-static inline void swap_winding(struct mcc_chunk_mesh *mesh, size_t start_idx) {
-    // Swap vertices for the first triangle (0,1,2)
-    mcc_vec3f temp_pos = mesh->positions[start_idx+1];
-    mesh->positions[start_idx+1] = mesh->positions[start_idx+2];
-    mesh->positions[start_idx+2] = temp_pos;
-    
-    mcc_vec2f temp_tex = mesh->texcoords[start_idx+1];
-    mesh->texcoords[start_idx+1] = mesh->texcoords[start_idx+2];
-    mesh->texcoords[start_idx+2] = temp_tex;
-    
-    uint8_t temp_texid = mesh->texids[start_idx+1];
-    mesh->texids[start_idx+1] = mesh->texids[start_idx+2];
-    mesh->texids[start_idx+2] = temp_texid;
-    
-    enum mcc_chunk_block_faces temp_face = mesh->faces[start_idx+1];
-    mesh->faces[start_idx+1] = mesh->faces[start_idx+2];
-    mesh->faces[start_idx+2] = temp_face;
-    
-    // Swap vertices for the second triangle (3,4,5)
-    temp_pos = mesh->positions[start_idx+4];
-    mesh->positions[start_idx+4] = mesh->positions[start_idx+3];
-    mesh->positions[start_idx+3] = temp_pos;
-    
-    temp_tex = mesh->texcoords[start_idx+4];
-    mesh->texcoords[start_idx+4] = mesh->texcoords[start_idx+3];
-    mesh->texcoords[start_idx+3] = temp_tex;
-    
-    temp_texid = mesh->texids[start_idx+4];
-    mesh->texids[start_idx+4] = mesh->texids[start_idx+3];
-    mesh->texids[start_idx+3] = temp_texid;
-    
-    temp_face = mesh->faces[start_idx+4];
-    mesh->faces[start_idx+4] = mesh->faces[start_idx+3];
-    mesh->faces[start_idx+3] = temp_face;
+static inline void append_quad_indices(struct mcc_chunk_mesh *mesh, size_t start_index_idx, size_t start_idx, bool swap_winding) {
+    uint32_t si = safe_to_u32(start_idx);
+    uint32_t *indices = &mesh->indices[start_index_idx];
+
+    if (!swap_winding) {
+        indices[0] = si+0; indices[1] = si+1; indices[2] = si+2;
+        indices[3] = si+2; indices[4] = si+1; indices[5] = si+3;
+    } else {
+        // Swap the last two vertices of each triangle to change the winding order
+        indices[0] = si+0; indices[1] = si+2; indices[2] = si+1;
+        indices[3] = si+1; indices[4] = si+2; indices[5] = si+3;
+    }
 }
 
 static inline void append_face_x(struct face_mesh fm) {
@@ -107,23 +114,17 @@ static inline void append_face_x(struct face_mesh fm) {
 
     float32_t x = fm.x, y = fm.y, z = fm.z;
 
-    // Default is counter-clockwise winding order
     mesh->positions[si+0] = (mcc_vec3f){{ x, y+0.f, z+0.f }};
     mesh->texcoords[si+0] = (mcc_vec2f){{ 0.f, 0.f }};
     mesh->positions[si+1] = (mcc_vec3f){{ x, y+0.f, z+fm.extent_z }};
     mesh->texcoords[si+1] = (mcc_vec2f){{ fm.extent_z, 0.f }};
     mesh->positions[si+2] = (mcc_vec3f){{ x, y+fm.extent_y, z+0.f }};
     mesh->texcoords[si+2] = (mcc_vec2f){{ 0.f, fm.extent_y }};
-    mesh->positions[si+3] = (mcc_vec3f){{ x, y+fm.extent_y, z+0.f }};
-    mesh->texcoords[si+3] = (mcc_vec2f){{ 0.f, fm.extent_y }};
-    mesh->positions[si+4] = (mcc_vec3f){{ x, y+0.f, z+fm.extent_z }};
-    mesh->texcoords[si+4] = (mcc_vec2f){{ fm.extent_z, 0.f }};
-    mesh->positions[si+5] = (mcc_vec3f){{ x, y+fm.extent_y, z+fm.extent_z }};
-    mesh->texcoords[si+5] = (mcc_vec2f){{ fm.extent_z, fm.extent_y }};
-
-    if (!fm.swap_winding) {
-        swap_winding(mesh, si);
-    }
+    mesh->positions[si+3] = (mcc_vec3f){{ x, y+fm.extent_y, z+fm.extent_z }};
+    mesh->texcoords[si+3] = (mcc_vec2f){{ fm.extent_z, fm.extent_y }};
+
+    // Default is counter-clockwise winding order
+    append_quad_indices(mesh, fm.start_index_idx, si, !fm.swap_winding);
 }
 
 static inline void append_face_z(struct face_mesh fm) {
@@ -132,23 +133,17 @@ static inline void append_face_z(struct face_mesh fm) {
 
     float32_t x = fm.x, y = fm.y, z = fm.z;
 
-    // Default is counter-clockwise winding order
     mesh->positions[si+0] = (mcc_vec3f){{ x+0.f, y+0.f, z }};
     mesh->texcoords[si+0] = (mcc_vec2f){{ 0.f, 0.f }};
     mesh->positions[si+1] = (mcc_vec3f){{ x+fm.extent_x, y+0.f, z }};
     mesh->texcoords[si+1] = (mcc_vec2f){{ fm.extent_x, 0.f }};
     mesh->positions[si+2] = (mcc_vec3f){{ x+0.f, y+fm.extent_y, z }};
     mesh->texcoords[si+2] = (mcc_vec2f){{ 0.f, fm.extent_y }};
-    mesh->positions[si+3] = (mcc_vec3f){{ x+0.f, y+fm.extent_y, z }};
-    mesh->texcoords[si+3] = (mcc_vec2f){{ 0.f, fm.extent_y }};
-    mesh->positions[si+4] = (mcc_vec3f){{ x+fm.extent_x, y+0.f, z }};
-    mesh->texcoords[si+4] = (mcc_vec2f){{ fm.extent_x, 0.f }};
-    mesh->positions[si+5] = (mcc_vec3f){{ x+fm.extent_x, y+fm.extent_y, z }};
-    mesh->texcoords[si+5] = (mcc_vec2f){{ fm.extent_x, fm.extent_y }};
-
-    if (fm.swap_winding) {
-        swap_winding(mesh, si);
-    }
+    mesh->positions[si+3] = (mcc_vec3f){{ x+fm.extent_x, y+fm.extent_y, z }};
+    mesh->texcoords[si+3] = (mcc_vec2f){{ fm.extent_x, fm.extent_y }};
+
+    // Default is counter-clockwise winding order
+    append_quad_indices(mesh, fm.start_index_idx, si, fm.swap_winding);
 }
 
 static inline void append_face_y(struct face_mesh fm) {
@@ -157,23 +152,17 @@ static inline void append_face_y(struct face_mesh fm) {
 
     float32_t x = fm.x, y = fm.y, z = fm.z;
 
-    // Default is counter-clockwise winding order
     mesh->positions[si+0] = (mcc_vec3f){{ x+0.f, y, z+0.f }};
     mesh->texcoords[si+0] = (mcc_vec2f){{ 0.f, 0.f }};
     mesh->positions[si+1] = (mcc_vec3f){{ x+fm.extent_x, y, z+0.f }};
     mesh->texcoords[si+1] = (mcc_vec2f){{ fm.extent_x, 0.f }};
     mesh->positions[si+2] = (mcc_vec3f){{ x+0.f, y, z+fm.extent_z }};
     mesh->texcoords[si+2] = (mcc_vec2f){{ 0.f, fm.extent_z }};
-    mesh->positions[si+3] = (mcc_vec3f){{ x+0.f, y, z+fm.extent_z }};
-    mesh->texcoords[si+3] = (mcc_vec2f){{ 0.f, fm.extent_z }};
-    mesh->positions[si+4] = (mcc_vec3f){{ x+fm.extent_x, y, z+0.f }};
-    mesh->texcoords[si+4] = (mcc_vec2f){{ fm.extent_x, 0.f }};
-    mesh->positions[si+5] = (mcc_vec3f){{ x+fm.extent_x, y, z+fm.extent_z }};
-    mesh->texcoords[si+5] = (mcc_vec2f){{ fm.extent_x, fm.extent_z }};
-    
-    if (!fm.swap_winding) {
-        swap_winding(mesh, si);
-    }
+    mesh->positions[si+3] = (mcc_vec3f){{ x+fm.extent_x, y, z+fm.extent_z }};
+    mesh->texcoords[si+3] = (mcc_vec2f){{ fm.extent_x, fm.extent_z }};
+
+    // Default is counter-clockwise winding order
+    append_quad_indices(mesh, fm.start_index_idx, si, !fm.swap_winding);
 }
 
 enum triangulation_axis: uint8_t {
@@ -360,6 +349,7 @@ void mcc_chunk_mesh_create(struct mcc_chunk_mesh *r_mesh, struct mcc_chunk_data
                     struct face_mesh face_mesh = {
                         .r_mesh = r_mesh,
                         .start_idx = r_mesh->vertex_count,
+                        .start_index_idx = r_mesh->index_count,
                         .x = (float)x + (face->dx == 0 ? 0.f : face->dx < 0 ? 0.f : 1.f),
                         .y = (float)y + (face->dy == 0 ? 0.f : face->dy < 0 ? 0.f : 1.f),
                         .z = (float)z + (face->dz == 0 ? 0.f : face->dz < 0 ? 0.f : 1.f),
@@ -368,9 +358,10 @@ void mcc_chunk_mesh_create(struct mcc_chunk_mesh *r_mesh, struct mcc_chunk_data
                         .extent_z = (float)(extent_z + 1),
                         .swap_winding = !face->is_negative,
                     };
-                    add_vertices(r_mesh, 6);
+                    add_vertices(r_mesh, 4);
+                    add_indices(r_mesh, 6);
 
-                    for (size_t i = face_mesh.start_idx; i < face_mesh.start_idx+6; i++) {
+                    for (size_t i = face_mesh.start_idx; i < face_mesh.start_idx+4; i++) {
                         r_mesh->normals[i] = (mcc_vec3f){{ (float)face->dx, (float)face->dy, (float)face->dz }};
                         r_mesh->texids[i] = r_chunk_data->blocks[block_idx];
                         r_mesh->faces[i] = face->face;
@@ -22,6 +22,14 @@ struct mcc_chunk_mesh {
     mcc_vec2f *texcoords;
     uint8_t *texids;
     enum mcc_chunk_block_faces *faces;
+
+    /**
+     * Triangle list indexing the vertices above, each quad is made of 4
+     * vertices and 6 indices.
+     */
+    size_t index_count;
+    size_t index_capacity;
+    uint32_t *indices;
 };
 
 void mcc_chunk_mesh_init(struct mcc_chunk_mesh *r_mesh);
@@ -1,14 +1,17 @@
 #include "cpu_rasterizer.h"
 #include "linalg/matrix.h"
+#include "linalg/transformations.h"
 #include "linalg/vector.h"
 #include "linalg/scalars.h"
+#include "linalg/simd.h"
 #include "safe_cast.h"
 #include "utils.h"
 #include "worksteal/thread_pool.h"
 #include "worksteal/wait_counter.h"
 
 #include <assert.h>
-#include <stdio.h>
+#include <math.h>
+#include <stdbit.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -19,11 +22,6 @@ struct processed_vertex {
     float w_inv;
 };
 
-struct plane {
-    mcc_vec4f normal;
-    float D;
-};
-
 typedef union {
     struct {
         struct processed_vertex v0;
@@ -33,271 +31,669 @@ typedef union {
     struct processed_vertex vertices[3];
 } primitive_t;
 
-const struct plane clipping_planes[] = {
-    { .normal = (mcc_vec4f){{ +0.f, +0.f, +1.f, +1.f }}, .D = +0.00f },
-    { .normal = (mcc_vec4f){{ +0.f, +0.f, -1.f, +1.f }}, .D = +0.00f },
-
-    // NOTE: Clipping -x +x -y +y seems useless as said by lisyarus's blog
-    //       but does it have any advantage ??
-    // { .normal = (mcc_vec4f){{ +0.f, +1.f, +0.f, +1.f }}, .D = +0.00f },
-    // { .normal = (mcc_vec4f){{ +0.f, -1.f, +0.f, +1.f }}, .D = +0.00f },
-
-    // { .normal = (mcc_vec4f){{ +1.f, +0.f, +0.f, +1.f }}, .D = +0.00f },
-    // { .normal = (mcc_vec4f){{ -1.f, +0.f, +0.f, +1.f }}, .D = +0.00f },
-};
-
-#define NUMBER_OF_CLIPPING_PLANES (sizeof(clipping_planes) / sizeof(*clipping_planes))
+/**
+ * Number of planes triangles may be clipped against: the near and far
+ * planes, and the four sides of the guard band (see `struct guard_band`).
+ */
+#define NUMBER_OF_CLIPPING_PLANES 6
 /**
  * Maximum number of triangles after clipping a single triangle
- * Defined as the 2^(the number of clipping planes)
- * (because each clipping plane may didive each triangle in two)
+ * (each clipping plane adds at most one vertex to the clipped polygon,
+ * which is then split in a fan of triangles)
+ */
+#define MAX_SUBTRIANGLES (1UL + NUMBER_OF_CLIPPING_PLANES)
+/**
+ * Maximum number of vertices created by the clipping of a single triangle,
+ * at most two for each plane.
+ */
+#define MAX_CLIP_VERTICES (2 * NUMBER_OF_CLIPPING_PLANES)
+/**
+ * Width and height (in pixels) of the screen tiles triangles are binned into
+ * before being rasterized in parallel (one task per tile).
+ */
+#define TILE_SIZE 64
+/**
+ * Number of vertices processed by each vertex processing task.
+ */
+#define VERTEX_TASK_SIZE (3 * 32)
+/**
+ * Draws are processed in batches of (at most) this many vertices, so that
+ * the memory needed for the processed vertices does not depend on the size of
+ * the mesh.
+ */
+#define STREAM_BATCH_VERTEX_COUNT (VERTEX_TASK_SIZE * 512)
+/**
+ * Number of batches that can be in flight at the same time (one being
+ * rasterized while the next one is processed).
+ */
+#define STREAM_RING_SIZE 2
+/**
+ * Number of bits of sub pixel precision of the fixed point screen space
+ * coordinates used for rasterization (16.8 fixed point).
+ */
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+/**
+ * Fixed point coordinates must stay under this (absolute) value for edge
+ * functions to not overflow 64 bits integers.
+ */
+#define MAX_FIXED_POINT_COORDINATE ((float)(1LL << 29))
+/**
+ * Number of coarse depth blocks along each side of a tile.
+ */
+#define TILE_COARSE_BLOCKS (TILE_SIZE / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE)
+static_assert(TILE_SIZE % MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE == 0);
+// Each tile keeps track of the coarse blocks to refresh in a single uint64_t
+static_assert(TILE_COARSE_BLOCKS * TILE_COARSE_BLOCKS <= 64);
+// Each row of a block is rasterized with a single SIMD step
+static_assert(MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE == MCC_SIMD_WIDTH);
+// So that the rows of the coarse blocks are contiguous in both layouts
+static_assert(MCC_CPURAST_ATTACHMENT_BLOCK_SIZE == MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE);
+static_assert(TILE_SIZE % MCC_CPURAST_ATTACHMENT_BLOCK_SIZE == 0);
+/**
+ * Margin subtracted from the nearest depth of a triangle before comparing it
+ * against the coarse depth buffer, to cover the rounding errors of the
+ * depth interpolation.
+ */
+#define COARSE_DEPTH_EPSILON 1e-6f
+/**
+ * Triangles covering at most this number of rows of pixels of a tile, in a
+ * single column of coarse depth blocks, are rasterized by
+ * `rasterize_small_triangle`.
+ */
+#define SMALL_TRIANGLE_MAX_ROWS 8
+/**
+ * Maximum number of refinements of the position, in the previous frame, of
+ * the pixel moving to a pixel of the new frame (see `reproject_pixels`).
+ */
+#define REPROJECT_MAX_ITERATIONS 8
+/**
+ * Distance (in pixels) under which a pixel of the previous frame is
+ * considered to move to the pixel center it is reprojected to, refinements
+ * stopping earlier once under REPROJECT_PRECISION.
  */
-#define MAX_SUBTRIANGLES (1UL << NUMBER_OF_CLIPPING_PLANES)
+#define REPROJECT_TOLERANCE 0.5f
+#define REPROJECT_PRECISION (1.f / 16.f)
 /**
- * Number of varyings to allocate at the start of rasterization.
+ * Draws with more varyings use the generic rasterization function.
  */
-#define PREALLOCATED_VARYINGS_SIZE (MAX_SUBTRIANGLES * 6)
+#define MAX_SPECIALIZED_VARYING_COUNT 4
 
-typedef struct {
-    union mcc_cpurast_shaders_varying *v[PREALLOCATED_VARYINGS_SIZE];
-    /**
-     * Index of the next free (currently unused) varying array.
-     */
-    size_t free_head;
-} preallocated_varyings_t;
+/**
+ * Used for the functions specialized by their (constant) arguments, see
+ * `struct raster_variant`.
+ */
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 
-static float signed_distance(struct plane plane, mcc_vec4f vertex) {
-    return mcc_vec4f_dot(plane.normal, vertex) + plane.D;
-}
+/**
+ * Alignment of all scratch arrays, enough for any SIMD type.
+ */
+#define SCRATCH_ALIGNMENT 64
 
 /**
- * Context for calculating sub triangles form a single triangle intersecting
- * a list of hardcoded clip planes
+ * Growable memory area whose content is not preserved when grown.
  */
-struct mcc_triangle_clip_context {
-    const size_t varying_count;
-    /**
-     * Assumes to have enough memory for MAX_SUBTRIANGLES triangles
-     * and to have a single initial triangle (3 vertices)
-     */
-    mcc_vec4f * const r_primitive_buffer;
-    /**
-     * Number of vertices outputed.
-     */
-    size_t out_vertex_count;
+struct scratch_buffer {
+    void *o_data;
+    size_t capacity;
 };
 
 /**
- * Context for calculating sub triangles form a single triangle intersecting
- * a single plane.
- * The convoluted workings of appending/overwrite of the primitives is intended
- * to remove the need for a temporary buffer (by means of premature optimisation (TM))
+ * Makes sure the buffer has at least `size` bytes and returns it.
  */
-struct plane_clip_triangle_context {
-    const size_t varying_count;
+static void *scratch_buffer_reserve(struct scratch_buffer *r_buffer, size_t size) {
+    if (r_buffer->capacity < size) {
+        free(r_buffer->o_data);
+        // Grow geometrically to not reallocate each time the size slightly increases
+        r_buffer->capacity = mcc_up_div(mcc_max(size, r_buffer->capacity + r_buffer->capacity / 2), SCRATCH_ALIGNMENT) * SCRATCH_ALIGNMENT;
+        r_buffer->o_data = aligned_alloc(SCRATCH_ALIGNMENT, r_buffer->capacity);
+        assert(r_buffer->o_data != NULL);
+    }
+    return r_buffer->o_data;
+}
+
+static void scratch_buffer_free(struct scratch_buffer *r_buffer) {
+    free(r_buffer->o_data);
+    r_buffer->o_data = NULL;
+    r_buffer->capacity = 0;
+}
+
+/**
+ * Splits a scratch memory area in multiple arrays.
+ * With a NULL base, only computes the size of the area.
+ */
+struct scratch_allocator {
+    uint8_t *o_base;
+    size_t size;
+};
+
+static void *scratch_alloc(struct scratch_allocator *r_alloc, size_t size) {
+    size_t offset = mcc_up_div(r_alloc->size, SCRATCH_ALIGNMENT) * SCRATCH_ALIGNMENT;
+    r_alloc->size = offset + size;
+    return r_alloc->o_base ? r_alloc->o_base + offset : NULL;
+}
+
+struct mcc_cpurast_context {
     /**
-     * Assumes to have enough memory for any required triangles.
+     * Buffers used by a batch until it is rasterized, one for each batch of
+     * the ring.
      */
-    mcc_vec4f * const r_primitive_buffer;
+    struct scratch_buffer primitive_buffers[STREAM_RING_SIZE];
+    struct scratch_buffer tile_offsets[STREAM_RING_SIZE];
+    struct scratch_buffer tile_triangles[STREAM_RING_SIZE];
+
+    struct scratch_buffer tile_bounds;
+    struct scratch_buffer vertex_tasks;
     /**
-     * Number of primitives in the primitive buffer, may be higher than 1
-     * in which case the other primitives will be left untouched, and
-     * if there is a new primitive created it will be apended after them extending
-     * the buffer size.
+     * Split between the vertex processing tasks.
      */
-    const size_t primitive_buffer_count;
+    struct scratch_buffer vertex_tasks_scratch;
+    struct scratch_buffer tile_heads;
+    struct scratch_buffer tile_tasks;
     /**
-     * Initially one, can be set to 0, 1 or 2 depending of the clipping results.
-     * If set to 0, this means the first primitive of the buffer should be
-     * removed.
-     * If set to 1 this means the first primitive of the buffer has been overwritten 
-     * with the new primitive.
-     * If the so 2, the previous primitive has been overwritten as well as a new
-     * primitive was appended to the end of the buffer (after primitive_buffer_count)
+     * Split between the tile rasterization tasks.
      */
-    size_t in_out_triangle_count;
-    const struct plane plane;
-};
-
-typedef struct intersection_context {
-    struct plane_clip_triangle_context *ctctx;
-    mcc_vec4f *v0;
-    mcc_vec4f *v1;
-    float value0;
-    float value1;
+    struct scratch_buffer tile_tasks_scratch;
     /**
-     * Out vertex, may be the same as v0 or v1
+     * Split between the tile rasterization tasks, only used if statistics
+     * are requested.
      */
-    mcc_vec4f *out;
-} ic_t;
+    struct scratch_buffer tile_statistics;
+};
 
-static void clip_edge(ic_t ctx) {
-    float t = ctx.value0 / (ctx.value0 - ctx.value1);
+struct mcc_cpurast_context *mcc_cpurast_context_create() {
+    struct mcc_cpurast_context *context = calloc(1, sizeof(*context));
+    assert(context != NULL);
+    return context;
+}
 
-    for (uint32_t i = 0; i < ctx.ctctx->varying_count+1; i++) {
-        ctx.out[i] = mcc_vec4f_add(
-            mcc_vec4f_scale(ctx.v0[i], 1.f - t),
-            mcc_vec4f_scale(ctx.v1[i], t)
-        );
+void mcc_cpurast_context_free(struct mcc_cpurast_context *o_context) {
+    if (!o_context)
+        return;
+    for (size_t i = 0; i < STREAM_RING_SIZE; i++) {
+        scratch_buffer_free(&o_context->primitive_buffers[i]);
+        scratch_buffer_free(&o_context->tile_offsets[i]);
+        scratch_buffer_free(&o_context->tile_triangles[i]);
     }
+    scratch_buffer_free(&o_context->tile_bounds);
+    scratch_buffer_free(&o_context->vertex_tasks);
+    scratch_buffer_free(&o_context->vertex_tasks_scratch);
+    scratch_buffer_free(&o_context->tile_heads);
+    scratch_buffer_free(&o_context->tile_tasks);
+    scratch_buffer_free(&o_context->tile_tasks_scratch);
+    scratch_buffer_free(&o_context->tile_statistics);
+    free(o_context);
 }
 
-typedef struct copy_edge_context {
-    struct plane_clip_triangle_context *ctctx;
-    mcc_vec4f *in;
-    mcc_vec4f *out;
-} cc_t;
+/**
+ * Attachments of a tile of a lazy clear still to be cleared.
+ */
+enum lazy_clear_tile_flags {
+    LAZY_CLEAR_TILE_COLOR = 1u << 0,
+    LAZY_CLEAR_TILE_DEPTH = 1u << 1,
+};
 
-static void copy_edge(cc_t ctx) {
-    for (uint32_t i = 0; i < ctx.ctctx->varying_count+1; i++) {
-        ctx.out[i] = ctx.in[i];
-    }
+/**
+ * Returns the given color in the format of color attachments.
+ */
+static uint32_t pack_color(struct mcc_color_rgba color) {
+    const uint8_t bgra[4] = {
+        (uint8_t)(color.b * 255.f),
+        (uint8_t)(color.g * 255.f),
+        (uint8_t)(color.r * 255.f),
+        (uint8_t)(color.a * 255.f),
+    };
+    uint32_t packed;
+    memcpy(&packed, bgra, sizeof(packed));
+    return packed;
 }
 
-/*
- * Adapted from
- * https://www.gabrielgambetta.com/computer-graphics-from-scratch/11-clipping.html
- * And
- * https://lisyarus.github.io/blog/posts/implementing-a-tiny-cpu-rasterizer-part-5.html
+size_t mcc_cpurast_attachment_pixel_count(uint32_t width, uint32_t height, enum mcc_cpurast_attachment_layout layout) {
+    if (layout == MCC_CPURAST_ATTACHMENT_LAYOUT_BLOCKED)
+        return (size_t)mcc_up_div(width, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE)
+             * (size_t)mcc_up_div(height, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE)
+             * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE;
+    assert(layout == MCC_CPURAST_ATTACHMENT_LAYOUT_LINEAR);
+    return (size_t)width * height;
+}
+
+/**
+ * Index of the pixel at (x, y) in the data of the attachments.
+ * In both layouts, the pixels of a row of a
+ * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE^2 block are contiguous.
  */
-static void clip_triangle_once(struct plane_clip_triangle_context *ctx) {
-    struct plane plane = ctx->plane;
-
-    // This makes indexing easier as to not require the multiplication by `ctx->varying_count + 1` each time
-    mcc_vec4f (*buf)[ctx->varying_count + 1] = (void*)ctx->r_primitive_buffer;
-    size_t in_v0 = 0 * 3 + 0;
-    size_t in_v1 = 0 * 3 + 1;
-    size_t in_v2 = 0 * 3 + 2;
-    size_t ou_v0 = ctx->primitive_buffer_count * 3 + 0;
-    size_t ou_v1 = ctx->primitive_buffer_count * 3 + 1;
-    size_t ou_v2 = ctx->primitive_buffer_count * 3 + 2;
-
-    float values[3] = {
-        signed_distance(plane, buf[in_v0][0]),
-        signed_distance(plane, buf[in_v1][0]),
-        signed_distance(plane, buf[in_v2][0])
-    };
+static inline size_t attachment_pixel_idx(const struct mcc_cpurast_rendering_attachment *r_attachment, uint32_t x, uint32_t y) {
+    if (r_attachment->layout == MCC_CPURAST_ATTACHMENT_LAYOUT_LINEAR)
+        return x + (size_t)y * r_attachment->width;
+
+    const size_t block_idx = x / MCC_CPURAST_ATTACHMENT_BLOCK_SIZE
+        + (size_t)(y / MCC_CPURAST_ATTACHMENT_BLOCK_SIZE) * mcc_up_div(r_attachment->width, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE);
+    return (block_idx * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE + y % MCC_CPURAST_ATTACHMENT_BLOCK_SIZE) * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE
+        + x % MCC_CPURAST_ATTACHMENT_BLOCK_SIZE;
+}
 
-    uint8_t mask = (values[0] <= 0.f ? 1 : 0) | (values[1] <= 0.f ? 2 : 0) | (values[2] <= 0.f ? 4 : 0);
+size_t mcc_cpurast_lazy_clear_tile_count(uint32_t width, uint32_t height) {
+    return (size_t)mcc_up_div(width, TILE_SIZE) * (size_t)mcc_up_div(height, TILE_SIZE);
+}
 
-    switch (mask) {
-    case 0b000:
-        // No changes
-        ctx->in_out_triangle_count = 1;
+/**
+ * Does the pending lazy clear of the given tile, if any.
+ */
+static void lazy_clear_tile(const struct mcc_cpurast_rendering_attachment *r_attachment, uint32_t tile_x, uint32_t tile_y) {
+    struct mcc_cpurast_lazy_clear *lazy_clear = r_attachment->o_lazy_clear;
+    uint8_t *tile = &lazy_clear->r_tiles[tile_x + tile_y * mcc_up_div(r_attachment->width, TILE_SIZE)];
+    if (!*tile)
         return;
-    case 0b001: {
-        clip_edge((ic_t){ ctx, buf[in_v0], buf[in_v1], values[0], values[1], buf[ou_v0] });
-        // output.triangles[output.triangle_count].v0 = v01;
-        copy_edge((cc_t){ ctx, buf[in_v1],                                   buf[ou_v1] });
-        // output.triangles[output.triangle_count].v1 = triangle.v1;
-        copy_edge((cc_t){ ctx, buf[in_v2],                                   buf[ou_v2] });
-        // output.triangles[output.triangle_count].v2 = triangle.v2;
-
-        clip_edge((ic_t){ ctx, buf[in_v0], buf[in_v2], values[0], values[2], buf[in_v2] });
-        // output.triangles[output.triangle_count].v2 = v02;
-        clip_edge((ic_t){ ctx, buf[in_v0], buf[in_v1], values[0], values[1], buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = v01;
-        copy_edge((cc_t){ ctx, buf[ou_v2 /* in place of in_v2 */],           buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = triangle.v2;
-
-        ctx->in_out_triangle_count = 2;
-        break;
+
+    // Like normal clears, also clears the padding of the last blocks
+    uint32_t width = r_attachment->width,
+             height = r_attachment->height;
+    if (r_attachment->layout == MCC_CPURAST_ATTACHMENT_LAYOUT_BLOCKED) {
+        width = mcc_up_div(width, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE) * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE;
+        height = mcc_up_div(height, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE) * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE;
     }
-    case 0b010: {
-        copy_edge((cc_t){ ctx, buf[in_v0],                                   buf[ou_v0] });
-        // output.triangles[output.triangle_count].v0 = triangle.v0;
-        clip_edge((ic_t){ ctx, buf[in_v1], buf[in_v0], values[1], values[0], buf[ou_v1] });
-        // output.triangles[output.triangle_count].v1 = v10;
-        copy_edge((cc_t){ ctx, buf[in_v2],                                   buf[ou_v2] });
-        // output.triangles[output.triangle_count].v2 = triangle.v2;
-
-        clip_edge((ic_t){ ctx, buf[in_v1], buf[in_v2], values[1], values[2], buf[in_v2] });
-        // output.triangles[output.triangle_count].v2 = v12;
-        clip_edge((ic_t){ ctx, buf[in_v1], buf[in_v0], values[1], values[0], buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = v10;
-        copy_edge((cc_t){ ctx, buf[ou_v2],                                   buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = triangle.v2;
-
-        ctx->in_out_triangle_count = 2;
-        break;
+    const uint32_t min_x = tile_x * TILE_SIZE,
+                   max_x = mcc_min(min_x + TILE_SIZE, width),
+                   min_y = tile_y * TILE_SIZE,
+                   max_y = mcc_min(min_y + TILE_SIZE, height);
+    // The tile is about to be used, so plain stores to keep it in the caches
+    for (uint32_t y = min_y; y < max_y; y++) {
+        for (uint32_t x = min_x; x < max_x; x += MCC_CPURAST_ATTACHMENT_BLOCK_SIZE) {
+            const size_t row_idx = attachment_pixel_idx(r_attachment, x, y);
+            const uint32_t row_width = mcc_min(max_x - x, MCC_CPURAST_ATTACHMENT_BLOCK_SIZE);
+            if (*tile & LAZY_CLEAR_TILE_COLOR) {
+                uint32_t *row = (uint32_t*)&r_attachment->o_color->r_data[row_idx * 4];
+                for (uint32_t i = 0; i < row_width; i++)
+                    row[i] = lazy_clear->packed_color;
+            }
+            if (*tile & LAZY_CLEAR_TILE_DEPTH) {
+                float32_t *row = &r_attachment->o_depth->r_data[row_idx];
+                for (uint32_t i = 0; i < row_width; i++)
+                    row[i] = lazy_clear->depth;
+            }
+        }
     }
-    case 0b011: {
-        clip_edge((ic_t){ ctx, buf[in_v0], buf[in_v2], values[0], values[2], buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = v02;
-        clip_edge((ic_t){ ctx, buf[in_v1], buf[in_v2], values[1], values[2], buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = v12;
-        copy_edge((cc_t){ ctx, buf[in_v2],                                   buf[in_v2] });
-        // output.triangles[output.triangle_count].v2 = triangle.v2;
+    *tile = 0;
+}
 
-        ctx->in_out_triangle_count = 1;
-        break;
+/**
+ * Recomputes the farthest depth of the given coarse depth block from the
+ * depth buffer.
+ */
+static void coarse_depth_refresh(const struct mcc_cpurast_rendering_attachment *r_attachment, uint32_t block_x, uint32_t block_y) {
+    auto depth_attachment = r_attachment->o_depth;
+    assert(depth_attachment && depth_attachment->o_coarse_data);
+
+    const uint32_t min_x = block_x * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE,
+                   min_y = block_y * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE;
+    const uint32_t max_x = mcc_min(min_x + MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE, r_attachment->width),
+                   max_y = mcc_min(min_y + MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE, r_attachment->height);
+
+    // Blocks are never empty, and -INFINITY is not available with
+    // -ffinite-math-only
+    float max_depth = depth_attachment->r_data[attachment_pixel_idx(r_attachment, min_x, min_y)];
+    for (uint32_t y = min_y; y < max_y; y++) {
+        const float32_t *row = &depth_attachment->r_data[attachment_pixel_idx(r_attachment, min_x, y)];
+        for (uint32_t x = 0; x < max_x - min_x; x++)
+            max_depth = mcc_max(max_depth, row[x]);
     }
-    case 0b100: {
-        copy_edge((cc_t){ ctx, buf[in_v0],                                   buf[ou_v0] });
-        // output.triangles[output.triangle_count].v0 = triangle.v0;
-        copy_edge((cc_t){ ctx, buf[in_v1],                                   buf[ou_v1] });
-        // output.triangles[output.triangle_count].v1 = triangle.v1;
-        clip_edge((ic_t){ ctx, buf[in_v2], buf[in_v0], values[2], values[0], buf[ou_v2] });
-        // output.triangles[output.triangle_count].v2 = v20;
-
-        clip_edge((ic_t){ ctx, buf[in_v2], buf[in_v0], values[2], values[0], buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = v20;
-        copy_edge((cc_t){ ctx, buf[in_v1],                                   buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = triangle.v1;
-        clip_edge((ic_t){ ctx, buf[in_v2], buf[ou_v1], values[2], values[1], buf[in_v2] });
-        //                                      ^ in place of in_v1
-        // output.triangles[output.triangle_count].v2 = v21;
-
-        ctx->in_out_triangle_count = 2;
-        break;
+
+    const uint32_t coarse_width = mcc_up_div(r_attachment->width, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE);
+    depth_attachment->o_coarse_data[block_x + block_y * coarse_width] = max_depth;
+}
+
+void mcc_cpurast_clear(const struct mcc_cpurast_clear_config *r_config) {
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_config->r_attachment;
+    const size_t size = mcc_cpurast_attachment_pixel_count(r_attachment->width, r_attachment->height, r_attachment->layout);
+    assert(!r_config->lazy || r_attachment->o_lazy_clear);
+
+    // Tile flags of the cleared attachments
+    uint8_t cleared = 0;
+
+    auto color_attachment = r_attachment->o_color;
+    if (color_attachment) {
+        cleared |= LAZY_CLEAR_TILE_COLOR;
+        const uint32_t packed_color = pack_color(r_config->clear_color);
+        if (r_config->lazy)
+            r_attachment->o_lazy_clear->packed_color = packed_color;
+        else
+            mcc_u32_stream_fill((uint32_t*)color_attachment->r_data, size, packed_color);
     }
-    case 0b101: {
-        clip_edge((ic_t){ ctx, buf[in_v0], buf[in_v1], values[0], values[1], buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = v01;
-        copy_edge((cc_t){ ctx, buf[in_v1],                                   buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = triangle.v1;
-        clip_edge((ic_t){ ctx, buf[in_v2], buf[in_v1], values[2], values[1], buf[in_v2] });
-        // output.triangles[output.triangle_count].v2 = v21;
 
-        ctx->in_out_triangle_count = 1;
-        break;
+    auto depth_attachment = r_attachment->o_depth;
+    if (depth_attachment) {
+        cleared |= LAZY_CLEAR_TILE_DEPTH;
+        if (r_config->lazy)
+            r_attachment->o_lazy_clear->depth = r_config->clear_depth;
+        else
+            mcc_f32_stream_fill(depth_attachment->r_data, size, r_config->clear_depth);
+
+        if (depth_attachment->o_coarse_data) {
+            size_t coarse_size = mcc_cpurast_coarse_depth_size(
+                r_attachment->width, r_attachment->height
+            );
+            for (size_t i = 0; i < coarse_size; i++) {
+                depth_attachment->o_coarse_data[i] = r_config->clear_depth;
+            }
+        }
     }
-    case 0b110: {
-        copy_edge((cc_t){ ctx, buf[in_v0],                                   buf[in_v0] });
-        // output.triangles[output.triangle_count].v0 = triangle.v0;
-        clip_edge((ic_t){ ctx, buf[in_v1], buf[in_v0], values[1], values[0], buf[in_v1] });
-        // output.triangles[output.triangle_count].v1 = v10;
-        clip_edge((ic_t){ ctx, buf[in_v2], buf[in_v0], values[2], values[0], buf[in_v2] });
-        // output.triangles[output.triangle_count].v2 = v20;
 
-        ctx->in_out_triangle_count = 1;
-        break;
+    // Also cancels the lazy clears overwritten by a normal clear
+    if (r_attachment->o_lazy_clear) {
+        uint8_t *tiles = r_attachment->o_lazy_clear->r_tiles;
+        const size_t tile_count = mcc_cpurast_lazy_clear_tile_count(r_attachment->width, r_attachment->height);
+        for (size_t i = 0; i < tile_count; i++)
+            tiles[i] = (uint8_t)((tiles[i] & ~cleared) | (r_config->lazy ? cleared : 0));
     }
-    case 0b111:
-        ctx->in_out_triangle_count = 0;
-        break;
+}
+
+void mcc_cpurast_finish_clear(const struct mcc_cpurast_rendering_attachment *r_attachment) {
+    if (!r_attachment->o_lazy_clear)
+        return;
+    for (uint32_t tile_y = 0; tile_y < mcc_up_div(r_attachment->height, TILE_SIZE); tile_y++) {
+        for (uint32_t tile_x = 0; tile_x < mcc_up_div(r_attachment->width, TILE_SIZE); tile_x++) {
+            lazy_clear_tile(r_attachment, tile_x, tile_y);
+        }
     }
 }
- 
-void mcc_cpurast_clear(const struct mcc_cpurast_clear_config *r_config) {
-    uint32_t size = r_config->r_attachment->height * r_config->r_attachment->width;
 
-    auto color_attachment = r_config->r_attachment->o_color;
-    if (color_attachment) {
-        for (uint32_t i = 0; i < size * 4; i += 4) {
-            color_attachment->r_data[i+0] = (uint8_t)(r_config->clear_color.b * 255.f);
-            color_attachment->r_data[i+1] = (uint8_t)(r_config->clear_color.g * 255.f);
-            color_attachment->r_data[i+2] = (uint8_t)(r_config->clear_color.r * 255.f);
-            color_attachment->r_data[i+3] = (uint8_t)(r_config->clear_color.a * 255.f);
+struct resolve_color_task_data {
+    const struct mcc_cpurast_rendering_attachment *r_attachment;
+    uint8_t *r_out_data;
+    /**
+     * Row of tiles to resolve.
+     */
+    uint32_t tile_y;
+
+    struct mcc_wait_counter *o_wait_counter;
+};
+
+static void resolve_color_task(void *data) {
+    const struct resolve_color_task_data *r_data = data;
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_data->r_attachment;
+    const struct mcc_cpurast_lazy_clear *lazy_clear = r_attachment->o_lazy_clear;
+    const uint32_t *color = (const uint32_t*)r_attachment->o_color->r_data;
+    uint32_t *out = (uint32_t*)r_data->r_out_data;
+
+    const uint32_t width = r_attachment->width,
+                   tile_count_x = mcc_up_div(width, TILE_SIZE);
+    const uint32_t min_y = r_data->tile_y * TILE_SIZE,
+                   max_y = mcc_min(min_y + TILE_SIZE, r_attachment->height);
+    for (uint32_t tile_x = 0; tile_x < tile_count_x; tile_x++) {
+        const uint32_t min_x = tile_x * TILE_SIZE,
+                       max_x = mcc_min(min_x + TILE_SIZE, width);
+
+        if (lazy_clear && (lazy_clear->r_tiles[tile_x + r_data->tile_y * tile_count_x] & LAZY_CLEAR_TILE_COLOR)) {
+            for (uint32_t y = min_y; y < max_y; y++) {
+                for (uint32_t x = min_x; x < max_x; x++)
+                    out[x + (size_t)y * width] = lazy_clear->packed_color;
+            }
+            continue;
+        }
+
+        // Rows of blocks are only contiguous over a block
+        const uint32_t row_width = r_attachment->layout == MCC_CPURAST_ATTACHMENT_LAYOUT_LINEAR
+            ? TILE_SIZE : MCC_CPURAST_ATTACHMENT_BLOCK_SIZE;
+        for (uint32_t y = min_y; y < max_y; y++) {
+            for (uint32_t x = min_x; x < max_x; x += row_width) {
+                memcpy(
+                    &out[x + (size_t)y * width],
+                    &color[attachment_pixel_idx(r_attachment, x, y)],
+                    sizeof(*out) * mcc_min(max_x - x, row_width)
+                );
+            }
         }
     }
 
-    auto depth_attachment = r_config->r_attachment->o_depth;
-    if (depth_attachment) {
-        for (uint32_t i = 0; i < size; i++) {
-            depth_attachment->r_data[i] = r_config->clear_depth;
+    if (r_data->o_wait_counter)
+        mcc_wait_counter_decrement(r_data->o_wait_counter, 1);
+}
+
+void mcc_cpurast_resolve_color(const struct mcc_cpurast_rendering_attachment *r_attachment, uint8_t *r_out_data) {
+    assert(r_attachment->o_color);
+    const uint32_t tile_count_y = mcc_up_div(r_attachment->height, TILE_SIZE);
+    if (tile_count_y == 0)
+        return;
+
+    struct resolve_color_task_data *tasks_data = malloc(sizeof(*tasks_data) * tile_count_y);
+    assert(tasks_data != NULL);
+    struct mcc_wait_counter wait_counter;
+    mcc_wait_counter_init(&wait_counter, tile_count_y);
+
+    struct mcc_thread_pool *pool = mcc_thread_pool_global();
+    mcc_thread_pool_lock(pool);
+    for (uint32_t tile_y = 0; tile_y < tile_count_y; tile_y++) {
+        tasks_data[tile_y] = (struct resolve_color_task_data){
+            .r_attachment = r_attachment,
+            .r_out_data = r_out_data,
+            .tile_y = tile_y,
+            .o_wait_counter = &wait_counter,
+        };
+        mcc_thread_pool_push_task(pool, (struct mcc_thread_pool_task){
+            .data = &tasks_data[tile_y],
+            .fn = resolve_color_task,
+        });
+    }
+    mcc_thread_pool_unlock(pool);
+
+    mcc_wait_counter_wait(&wait_counter);
+    mcc_wait_counter_free(&wait_counter);
+    free(tasks_data);
+}
+
+struct reproject_task_data {
+    const struct mcc_cpurast_reproject_config *r_config;
+    /**
+     * From the pixel coordinates (y pointing down) and depth of the
+     * previous frame to the homogeneous pixel coordinates of the new frame.
+     */
+    mcc_mat4f previous_to_current;
+    /**
+     * Inverse of `previous_to_current`.
+     */
+    mcc_mat4f current_to_previous;
+    /**
+     * Row of tiles to reproject.
+     */
+    uint32_t tile_y;
+    /**
+     * Set to the number of tiles of the row to render again.
+     */
+    uint32_t out_dirty_tile_count;
+
+    struct mcc_wait_counter *o_wait_counter;
+};
+
+/**
+ * Reprojects the first `lane_count` of the MCC_SIMD_WIDTH horizontally
+ * adjacent pixels of the new frame starting at (x, y), x being a multiple
+ * of MCC_SIMD_WIDTH, from the previous frame.
+ * Returns the mask of the pixels that a pixel of the previous frame moves
+ * to, which are written.
+ * Written with plain loops over the pixels so that they are vectorized.
+ */
+static uint32_t reproject_pixels(const struct reproject_task_data *r_data, uint32_t x, uint32_t y, uint32_t lane_count) {
+    const struct mcc_cpurast_rendering_attachment *r_previous = r_data->r_config->r_previous_attachment,
+                                                  *r_attachment = r_data->r_config->r_attachment;
+    const float width = (float)r_attachment->width,
+                height = (float)r_attachment->height;
+    // The pixels are contiguous in both layouts
+    const size_t idx = attachment_pixel_idx(r_attachment, x, y);
+
+    float target[2][MCC_SIMD_WIDTH];
+    // Position, in the previous frame, of the pixel moving to each target
+    float source[3][MCC_SIMD_WIDTH];
+    float clip[4][MCC_SIMD_WIDTH];
+    for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+        target[0][lane] = (float)(x + lane) + 0.5f;
+        target[1][lane] = (float)y + 0.5f;
+        source[0][lane] = target[0][lane];
+        source[1][lane] = target[1][lane];
+        source[2][lane] = r_previous->o_depth->r_data[idx + mcc_min(lane, lane_count - 1)];
+    }
+
+    // Pixels that do not move in depth start at the right position
+    mcc_mat4f_mul_points_soa(r_data->current_to_previous, source, clip);
+    for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+        if (clip[3][lane] > 0.f) {
+            source[0][lane] = clip[0][lane] / clip[3][lane];
+            source[1][lane] = clip[1][lane] / clip[3][lane];
+        }
+    }
+
+    // Fixed point iteration: each position is moved by how far the pixel
+    // there lands from its target, converging as long as the motion is
+    // smooth around it (and not at disocclusions)
+    uint32_t pending = (1u << lane_count) - 1u,
+             found = 0;
+    size_t source_idx[MCC_SIMD_WIDTH] = {};
+    for (uint32_t iteration = 0; pending; iteration++) {
+        for (uint32_t lanes = pending; lanes; lanes &= lanes - 1) {
+            const uint32_t lane = stdc_trailing_zeros(lanes);
+            if (!(source[0][lane] >= 0.f && source[0][lane] < width && source[1][lane] >= 0.f && source[1][lane] < height)) {
+                pending &= ~(1u << lane);
+                continue;
+            }
+            source_idx[lane] = attachment_pixel_idx(r_previous, (uint32_t)source[0][lane], (uint32_t)source[1][lane]);
+            source[2][lane] = r_previous->o_depth->r_data[source_idx[lane]];
+        }
+
+        mcc_mat4f_mul_points_soa(r_data->previous_to_current, source, clip);
+        float error[2][MCC_SIMD_WIDTH];
+        uint32_t in_front = 0,
+                 converged = 0,
+                 close = 0;
+        for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+            const float w_inv = 1.f / clip[3][lane];
+            error[0][lane] = target[0][lane] - clip[0][lane] * w_inv;
+            error[1][lane] = target[1][lane] - clip[1][lane] * w_inv;
+            clip[2][lane] *= w_inv;
+            const float max_error = fmaxf(fabsf(error[0][lane]), fabsf(error[1][lane]));
+            in_front |= (uint32_t)(clip[3][lane] > 0.f) << lane;
+            converged |= (uint32_t)(max_error <= REPROJECT_PRECISION) << lane;
+            close |= (uint32_t)(max_error <= REPROJECT_TOLERANCE) << lane;
+        }
+
+        pending &= in_front;
+        const uint32_t done = iteration == REPROJECT_MAX_ITERATIONS ? pending : pending & converged;
+        for (uint32_t lanes = done & close; lanes; lanes &= lanes - 1) {
+            const uint32_t lane = stdc_trailing_zeros(lanes);
+            memcpy(&r_attachment->o_color->r_data[(idx + lane) * 4], &r_previous->o_color->r_data[source_idx[lane] * 4], 4);
+            r_attachment->o_depth->r_data[idx + lane] = clip[2][lane];
+        }
+        found |= done & close;
+        pending &= ~done;
+
+        for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+            source[0][lane] += error[0][lane];
+            source[1][lane] += error[1][lane];
+        }
+    }
+    return found;
+}
+
+static void reproject_task(void *data) {
+    struct reproject_task_data *r_data = data;
+    const struct mcc_cpurast_reproject_config *r_config = r_data->r_config;
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_config->r_attachment;
+
+    const uint32_t tile_count_x = mcc_up_div(r_attachment->width, TILE_SIZE);
+    const uint32_t min_y = r_data->tile_y * TILE_SIZE,
+                   max_y = mcc_min(min_y + TILE_SIZE, r_attachment->height);
+    r_data->out_dirty_tile_count = 0;
+    for (uint32_t tile_x = 0; tile_x < tile_count_x; tile_x++) {
+        const uint32_t min_x = tile_x * TILE_SIZE,
+                       max_x = mcc_min(min_x + TILE_SIZE, r_attachment->width);
+        const size_t tile_idx = tile_x + (size_t)r_data->tile_y * tile_count_x;
+        uint8_t *tile = &r_attachment->o_lazy_clear->r_tiles[tile_idx];
+        assert(*tile == (LAZY_CLEAR_TILE_COLOR | LAZY_CLEAR_TILE_DEPTH));
+
+        // Stops at the first pixels not found, the tile being rendered again
+        bool complete = true;
+        for (uint32_t y = min_y; complete && y < max_y; y++) {
+            for (uint32_t x = min_x; complete && x < max_x; x += MCC_SIMD_WIDTH) {
+                const uint32_t lane_count = mcc_min(max_x - x, MCC_SIMD_WIDTH);
+                complete = reproject_pixels(r_data, x, y, lane_count) == (1u << lane_count) - 1u;
+            }
+        }
+
+        r_config->r_out_tile_mask[tile_idx] = complete ? 0 : 1;
+        if (!complete) {
+            r_data->out_dirty_tile_count++;
+            continue;
         }
+        *tile = 0;
+        if (r_attachment->o_depth->o_coarse_data) {
+            for (uint32_t block_y = min_y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE; block_y < mcc_up_div(max_y, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE); block_y++) {
+                for (uint32_t block_x = min_x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE; block_x < mcc_up_div(max_x, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE); block_x++)
+                    coarse_depth_refresh(r_attachment, block_x, block_y);
+            }
+        }
+    }
+
+    if (r_data->o_wait_counter)
+        mcc_wait_counter_decrement(r_data->o_wait_counter, 1);
+}
+
+size_t mcc_cpurast_reproject(const struct mcc_cpurast_reproject_config *r_config) {
+    const struct mcc_cpurast_rendering_attachment *r_previous = r_config->r_previous_attachment,
+                                                  *r_attachment = r_config->r_attachment;
+    assert(r_previous->o_color && r_previous->o_depth);
+    assert(r_attachment->o_color && r_attachment->o_depth && r_attachment->o_lazy_clear);
+    assert(r_previous->width == r_attachment->width && r_previous->height == r_attachment->height);
+    assert(r_previous->layout == r_attachment->layout);
+    const uint32_t tile_count_y = mcc_up_div(r_attachment->height, TILE_SIZE);
+    if (tile_count_y == 0)
+        return 0;
+
+    const float width = (float)r_attachment->width,
+                height = (float)r_attachment->height;
+    const mcc_mat4f pixel_to_ndc = mcc_mat4f_mul(
+        mcc_mat4f_translate((mcc_vec3f){{ -1.f, 1.f, 0.f }}),
+        mcc_mat4f_scale_xy(2.f / width, -2.f / height)
+    );
+    const mcc_mat4f ndc_to_pixel = mcc_mat4f_inverse(pixel_to_ndc);
+    const mcc_mat4f previous_to_current = mcc_mat4f_mul(ndc_to_pixel, mcc_mat4f_mul(
+        mcc_mat4f_mul(r_config->view_projection, mcc_mat4f_inverse(r_config->previous_view_projection)),
+        pixel_to_ndc
+    ));
+    const mcc_mat4f current_to_previous = mcc_mat4f_inverse(previous_to_current);
+
+    struct reproject_task_data *tasks_data = malloc(sizeof(*tasks_data) * tile_count_y);
+    assert(tasks_data != NULL);
+    struct mcc_wait_counter wait_counter;
+    mcc_wait_counter_init(&wait_counter, tile_count_y);
+
+    struct mcc_thread_pool *pool = mcc_thread_pool_global();
+    mcc_thread_pool_lock(pool);
+    for (uint32_t tile_y = 0; tile_y < tile_count_y; tile_y++) {
+        tasks_data[tile_y] = (struct reproject_task_data){
+            .r_config = r_config,
+            .previous_to_current = previous_to_current,
+            .current_to_previous = current_to_previous,
+            .tile_y = tile_y,
+            .o_wait_counter = &wait_counter,
+        };
+        mcc_thread_pool_push_task(pool, (struct mcc_thread_pool_task){
+            .data = &tasks_data[tile_y],
+            .fn = reproject_task,
+        });
     }
+    mcc_thread_pool_unlock(pool);
+
+    mcc_wait_counter_wait(&wait_counter);
+    mcc_wait_counter_free(&wait_counter);
+
+    size_t dirty_tile_count = 0;
+    for (uint32_t tile_y = 0; tile_y < tile_count_y; tile_y++)
+        dirty_tile_count += tasks_data[tile_y].out_dirty_tile_count;
+    free(tasks_data);
+    return dirty_tile_count;
+}
+
+size_t mcc_cpurast_coarse_depth_size(uint32_t width, uint32_t height) {
+    return (size_t)mcc_up_div(width, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE)
+         * (size_t)mcc_up_div(height, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE);
 }
 
 bool mcc_depth_comparison_fn_alaways(float, float) {
@@ -332,93 +728,1113 @@ bool mcc_depth_comparison_fn_neq(float previous, float new) {
     return new != previous;
 }
 
-struct mcc_barycentric_coords {
-    /**
-     * Weight for v1
-     */
-    float u;
+/**
+ * Rectangle of pixels, max bounds are exclusive.
+ */
+struct pixel_rect {
+    uint32_t min_x;
+    uint32_t min_y;
+    uint32_t max_x;
+    uint32_t max_y;
+};
+
+/**
+ * Same as `struct pixel_rect` but possibly outside of the attachment.
+ */
+struct pixel_range {
+    int64_t min_x;
+    int64_t min_y;
+    int64_t max_x;
+    int64_t max_y;
+};
+
+/**
+ * Mapping of the normalized device coordinates of a draw to the pixels of
+ * its attachment, and pixels it can write.
+ */
+struct viewport {
     /**
-     * Weight for v2
+     * Position and size, in pixels, of the viewport.
      */
-    float v;
+    float x;
+    float y;
+    float width;
+    float height;
     /**
-     * Weight for v0
+     * The scissor, inside of the attachment and of the viewport.
      */
-    float w;
+    struct pixel_rect scissor;
 };
 
-struct mcc_pixel_params {
-    struct mcc_barycentric_coords barycentric;
-    mcc_vec2f screen_pos;
-    float depth;
-    size_t pixel_idx;
+static struct viewport viewport_setup(const struct mcc_cpurast_render_config *r_config) {
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_config->r_attachment;
+    const struct mcc_cpurast_rect full = { .width = r_attachment->width, .height = r_attachment->height };
+    const struct mcc_cpurast_rect viewport = r_config->viewport.width && r_config->viewport.height ? r_config->viewport : full,
+                                  scissor = r_config->scissor.width && r_config->scissor.height ? r_config->scissor : full;
+
+    // Triangles are not clipped against the sides of the viewport (see
+    // `struct guard_band`), so the scissor also keeps them inside of it.
+    // Empty if the scissor is fully outside of the attachment or of the
+    // viewport
+    const uint64_t min_x = mcc_max((uint64_t)scissor.x, (uint64_t)viewport.x),
+                   min_y = mcc_max((uint64_t)scissor.y, (uint64_t)viewport.y),
+                   max_x = mcc_min(mcc_min((uint64_t)scissor.x + scissor.width, (uint64_t)viewport.x + viewport.width), (uint64_t)r_attachment->width),
+                   max_y = mcc_min(mcc_min((uint64_t)scissor.y + scissor.height, (uint64_t)viewport.y + viewport.height), (uint64_t)r_attachment->height);
+    return (struct viewport){
+        .x = (float)viewport.x,
+        .y = (float)viewport.y,
+        .width = (float)viewport.width,
+        .height = (float)viewport.height,
+        .scissor = {
+            .min_x = (uint32_t)mcc_min(min_x, max_x),
+            .min_y = (uint32_t)mcc_min(min_y, max_y),
+            .max_x = (uint32_t)max_x,
+            .max_y = (uint32_t)max_y,
+        },
+    };
+}
+
+/**
+ * Affine transformation from pixel indices to the normalized device
+ * coordinates of the pixel's center: `index * scale + offset`.
+ */
+struct pixel_to_ndc {
+    float scale_x;
+    float scale_y;
+    float offset_x;
+    float offset_y;
 };
 
-typedef bool (*mcc_polygon_filter_fn)(const struct mcc_barycentric_coords *coords);
+static inline struct pixel_to_ndc viewport_pixel_to_ndc(const struct viewport *r_viewport) {
+    const float scale_x = 2.f / r_viewport->width,
+                scale_y =-2.f / r_viewport->height;
+    return (struct pixel_to_ndc){
+        .scale_x = scale_x,
+        .scale_y = scale_y,
+        .offset_x = (0.5f - r_viewport->x) * scale_x - 1.f,
+        .offset_y = (0.5f - r_viewport->y) * scale_y + 1.f,
+    };
+}
 
-struct mcc_rasterization_context {
-    enum mcc_cpurast_culling_mode culling_mode;
-    struct mcc_cpurast_rendering_attachment *r_attachment;
-    primitive_t *r_primitive;
-    union mcc_cpurast_shaders_varying *r_fragment_varyings;
-    struct mcc_cpurast_fragment_shader_input *r_frag_input;
-    struct mcc_fragment_shader *r_fragment_shader;
-    mcc_depth_comparison_fn o_depth_comparison_fn;
-    size_t varying_count;
+/**
+ * Triangle snapped to the fixed point screen space (y pointing down) grid
+ * used for rasterization, each coordinate is in 1/SUBPIXEL_ONE pixels.
+ */
+struct fixed_point_triangle {
+    int64_t x[3];
+    int64_t y[3];
 };
 
-typedef void (*mcc_rasterize_triangle_fn)(const struct mcc_rasterization_context*);
+static inline int64_t floor_div_i64(int64_t num, int64_t den) {
+    assert(den > 0);
+    int64_t quot = num / den;
+    return (num % den != 0 && num < 0) ? quot - 1 : quot;
+}
 
-static void process_fragment(const struct mcc_rasterization_context *r_context, const struct mcc_pixel_params *pixel) {
-    auto depth_attachment = r_context->r_attachment->o_depth;
-    auto color_attachment = r_context->r_attachment->o_color;
-    primitive_t *primitive = r_context->r_primitive;
-    const struct mcc_barycentric_coords *barycentric = &pixel->barycentric;
-    
-    // Interpolation of varying attributes
-    for (size_t varying_i = 0; varying_i < r_context->varying_count; varying_i++) {
-        float w0             = primitive->v0.w_inv,
-              w1             = primitive->v1.w_inv,
-              w2             = primitive->v2.w_inv,
-              w_interpolated = barycentric->w * w0 + barycentric->u * w1 + barycentric->v * w2,
-              correction     = 1.0f / w_interpolated;
-        // TEMP: Disables perspective correction
-        // correction = 1.f;
-        
-        mcc_vec4f var0 = primitive->v0.varyings[varying_i].vec4f,
-                  var1 = primitive->v1.varyings[varying_i].vec4f,
-                  var2 = primitive->v2.varyings[varying_i].vec4f;
-
-        mcc_vec4f result = mcc_vec4f_add(
-            mcc_vec4f_add(
-                mcc_vec4f_scale(var0, barycentric->w * w0 * correction),
-                mcc_vec4f_scale(var1, barycentric->u * w1 * correction)
-            ),
-            mcc_vec4f_scale(var2, barycentric->v * w2 * correction)
-        );
-        
-        r_context->r_fragment_varyings[varying_i].vec4f = result;
-    }
+/**
+ * Snaps the triangle of the given normalized device coordinates to the
+ * sub pixel grid.
+ * Returns false if the triangle is too big to be represented.
+ */
+static bool fixed_point_triangle_setup(
+    mcc_vec2f p0, mcc_vec2f p1, mcc_vec2f p2,
+    const struct viewport *r_viewport,
+    struct fixed_point_triangle *r_out
+) {
+    const mcc_vec2f ps[3] = { p0, p1, p2 };
+    const float scale_x = 0.5f * r_viewport->width * (float)SUBPIXEL_ONE,
+                scale_y = 0.5f * r_viewport->height * (float)SUBPIXEL_ONE;
+    const float offset_x = r_viewport->x * (float)SUBPIXEL_ONE,
+                offset_y = r_viewport->y * (float)SUBPIXEL_ONE;
 
-    // Execute the fragment shader
-    r_context->r_frag_input->in_frag_coord = (mcc_vec3f){{ pixel->screen_pos.x, pixel->screen_pos.y, pixel->depth }};
-    r_context->r_fragment_shader->r_fn(r_context->r_frag_input);
+    for (size_t i = 0; i < 3; i++) {
+        float x = ( ps[i].x + 1.f) * scale_x + offset_x,
+              y = (-ps[i].y + 1.f) * scale_y + offset_y;
+        // NOTE: Also catches NaNs
+        if (!(fabsf(x) < MAX_FIXED_POINT_COORDINATE && fabsf(y) < MAX_FIXED_POINT_COORDINATE))
+            return false;
+        r_out->x[i] = (int64_t)lroundf(x);
+        r_out->y[i] = (int64_t)lroundf(y);
+    }
+    return true;
+}
+
+/**
+ * Computes the pixels whose center may be covered by the triangle.
+ */
+static struct pixel_range fixed_point_triangle_range(const struct fixed_point_triangle *r_tri) {
+    int64_t min_x = mcc_min(r_tri->x[0], mcc_min(r_tri->x[1], r_tri->x[2]));
+    int64_t min_y = mcc_min(r_tri->y[0], mcc_min(r_tri->y[1], r_tri->y[2]));
+    int64_t max_x = mcc_max(r_tri->x[0], mcc_max(r_tri->x[1], r_tri->x[2]));
+    int64_t max_y = mcc_max(r_tri->y[0], mcc_max(r_tri->y[1], r_tri->y[2]));
+
+    // The center of pixel x is at `x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2`
+    return (struct pixel_range){
+        .min_x = -floor_div_i64(SUBPIXEL_ONE / 2 - min_x, SUBPIXEL_ONE),
+        .min_y = -floor_div_i64(SUBPIXEL_ONE / 2 - min_y, SUBPIXEL_ONE),
+        .max_x = floor_div_i64(max_x - SUBPIXEL_ONE / 2, SUBPIXEL_ONE) + 1,
+        .max_y = floor_div_i64(max_y - SUBPIXEL_ONE / 2, SUBPIXEL_ONE) + 1,
+    };
+}
+
+/**
+ * Computes the pixels of the scissor whose center may be covered by the
+ * triangle (the result may be empty).
+ * Shared by the binning and the rasterization so both always agree.
+ */
+static struct pixel_rect fixed_point_triangle_bounds(const struct fixed_point_triangle *r_tri, const struct viewport *r_viewport) {
+    const struct pixel_range range = fixed_point_triangle_range(r_tri);
+    const struct pixel_rect scissor = r_viewport->scissor;
+    struct pixel_rect rect = {
+        .min_x = (uint32_t)mcc_min(mcc_max(range.min_x, (int64_t)scissor.min_x), (int64_t)scissor.max_x),
+        .min_y = (uint32_t)mcc_min(mcc_max(range.min_y, (int64_t)scissor.min_y), (int64_t)scissor.max_y),
+        .max_x = (uint32_t)mcc_min(mcc_max(range.max_x, (int64_t)scissor.min_x), (int64_t)scissor.max_x),
+        .max_y = (uint32_t)mcc_min(mcc_max(range.max_y, (int64_t)scissor.min_y), (int64_t)scissor.max_y),
+    };
+    if (rect.min_x >= rect.max_x || rect.min_y >= rect.max_y)
+        return (struct pixel_rect){};
+    return rect;
+}
+
+/**
+ * The weight of v0 is implicitly `1 - u - v`.
+ */
+struct mcc_barycentric_coords {
+    /**
+     * Weight for v1
+     */
+    float u;
+    /**
+     * Weight for v2
+     */
+    float v;
+};
+
+/**
+ * Plane equation of an attribute over a triangle, as a function of the
+ * barycentric coordinates (which are affine in screen space):
+ * `value = base + u * du + v * dv`
+ */
+struct attribute_plane {
+    float base;
+    float du;
+    float dv;
+};
+
+/**
+ * Plane equation of each component of a varying.
+ */
+struct varying_plane {
+    mcc_vec4f base;
+    mcc_vec4f du;
+    mcc_vec4f dv;
+};
+
+static inline struct attribute_plane attribute_plane_setup(float a0, float a1, float a2) {
+    return (struct attribute_plane){ .base = a0, .du = a1 - a0, .dv = a2 - a0 };
+}
+
+static inline float attribute_plane_eval(struct attribute_plane plane, float u, float v) {
+    return plane.base + u * plane.du + v * plane.dv;
+}
+
+/**
+ * Depth of a fragment of the triangle.
+ * Never inlined so that it is computed by the same instructions in every
+ * specialized kernel whatever the floating point optimizations: the depth
+ * equal pass of the depth prepass needs the exact depths of the first pass.
+ */
+static __attribute__((noinline)) float fragment_depth(struct attribute_plane depth_plane, float u, float v) {
+    return attribute_plane_eval(depth_plane, u, v);
+}
+
+/**
+ * Precomputed once per triangle for its fragments to be shaded with
+ * `process_fragment` and `process_fragment_packet`.
+ * Perspective correct interpolation is done by interpolating 1/w and the
+ * varyings divided by w, and dividing the latter by the former.
+ */
+struct triangle_setup {
+    struct attribute_plane w_inv;
+    /**
+     * Planes of the varyings divided by w, one for each varying.
+     */
+    struct varying_plane *r_varyings;
+};
+
+struct mcc_pixel_params {
+    struct mcc_barycentric_coords barycentric;
+    mcc_vec2f screen_pos;
+    float depth;
+    size_t pixel_idx;
+};
+
+/**
+ * Edge function of the (fixed point) triangle, positive on the inside:
+ * `(p.x - a.x) * (b.y - a.y) - (p.y - a.y) * (b.x - a.x)`
+ * where `p` is the center of a pixel. Being affine in the pixel indices it
+ * can be stepped incrementally, and being exact there are no cracks or
+ * double hits between triangles sharing an edge.
+ */
+struct edge_equation {
+    int64_t ax, ay;
+    int64_t dx, dy;
+    /**
+     * Minimum value of the edge function for a pixel to be inside.
+     * Implements the top-left rule: pixels exactly on the edge are only
+     * inside if it is a top or a left edge.
+     */
+    int64_t threshold;
+};
+
+/**
+ * Assumes the triangle has a positive area (as computed by the edge function).
+ */
+static inline struct edge_equation edge_equation_setup(const struct fixed_point_triangle *r_tri, size_t a, size_t b) {
+    struct edge_equation eq = {
+        .ax = r_tri->x[a], .ay = r_tri->y[a],
+        .dx = r_tri->x[b] - r_tri->x[a],
+        .dy = r_tri->y[b] - r_tri->y[a],
+    };
+    // With this winding (and y pointing down), left edges go down and
+    // top edges go left
+    bool is_top = eq.dy == 0 && eq.dx < 0;
+    bool is_left = eq.dy > 0;
+    eq.threshold = is_top || is_left ? 0 : 1;
+    return eq;
+}
+
+/**
+ * Value of the edge function at the center of pixel (x, y).
+ */
+static inline int64_t edge_equation_eval(struct edge_equation eq, uint32_t x, uint32_t y) {
+    int64_t px = (int64_t)x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2,
+            py = (int64_t)y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+    return (px - eq.ax) * eq.dy - (py - eq.ay) * eq.dx;
+}
+
+/**
+ * Increment of the edge function when moving one pixel to the right.
+ */
+static inline int64_t edge_equation_step_x(struct edge_equation eq) {
+    return eq.dy * SUBPIXEL_ONE;
+}
+
+/**
+ * Row of MCC_SIMD_WIDTH pixels starting at (x, y), only the pixels whose
+ * bit is set in `mask` are valid.
+ */
+struct mcc_pixel_packet_params {
+    uint32_t x;
+    uint32_t y;
+    uint32_t mask;
+    float u[MCC_SIMD_WIDTH];
+    float v[MCC_SIMD_WIDTH];
+    float depth[MCC_SIMD_WIDTH];
+};
+static_assert(MCC_CPURAST_FRAGMENT_PACKET_SIZE == MCC_SIMD_WIDTH);
+
+/**
+ * Value of `tile_visibility.triangles` for pixels not covered by any triangle.
+ */
+#define VISIBILITY_NONE (~0u)
+/**
+ * Set in `tile_visibility.triangles` if the rasterizer swapped the last two
+ * vertices of the triangle, which the barycentric coordinates are relative to.
+ */
+#define VISIBILITY_SWAPPED (1u << 31)
+
+/**
+ * What is needed to shade each pixel of a tile after all of its triangles
+ * are rasterized, for deferred shading.
+ * Each array has one element for each pixel of the tile (row major,
+ * TILE_SIZE * TILE_SIZE pixels).
+ */
+struct tile_visibility {
+    /**
+     * Index, in the tile's triangle list, of the triangle visible in each
+     * pixel.
+     */
+    uint32_t *triangles;
+    float *u;
+    float *v;
+    float *depth;
+};
+
+/**
+ * Fragment statistics of the consecutive triangles of a draw in a tile's
+ * triangle list, merged in the draw's statistics once the tile is rasterized.
+ */
+struct draw_fragment_statistics {
+    uint32_t draw_idx;
+    /**
+     * Index, in the tile's triangle list, of the first triangle counted here.
+     */
+    uint32_t first_triangle;
+    uint64_t depth_tested_fragments;
+    uint64_t samples_passed;
+    uint64_t fragment_shader_invocations;
+};
+
+struct mcc_rasterization_context {
+    enum mcc_cpurast_culling_mode culling_mode;
+    enum mcc_cpurast_polygon_mode polygon_mode;
+    struct viewport viewport;
+    struct mcc_cpurast_rendering_attachment *r_attachment;
+    primitive_t *r_primitive;
+    /**
+     * Filled from `r_primitive` before shading its fragments, see
+     * `triangle_setup_compute`.
+     */
+    struct triangle_setup *r_setup;
+    union mcc_cpurast_shaders_varying *r_fragment_varyings;
+    struct mcc_cpurast_fragment_shader_input *r_frag_input;
+    /**
+     * Used instead of `r_frag_input` if the fragment shader has a packet
+     * function.
+     */
+    struct mcc_cpurast_fragment_packet_input *r_frag_packet_input;
+    /**
+     * NULL for depth only draws.
+     */
+    struct mcc_fragment_shader *o_fragment_shader;
+    mcc_depth_comparison_fn o_depth_comparison_fn;
+    size_t varying_count;
+    /**
+     * Only pixels inside of this rect are rasterized (the current tile).
+     */
+    struct pixel_rect tile_rect;
+    /**
+     * One bit for each coarse depth block of the tile (row major), set when
+     * pixels of the block were written since its coarse depth was computed.
+     * Unused if the depth attachment has no coarse depth buffer.
+     */
+    uint64_t *r_coarse_dirty;
+    /**
+     * If not NULL, fragments are written in it instead of being shaded.
+     */
+    struct tile_visibility *o_visibility;
+    /**
+     * Index, in the tile's triangle list, of the triangle being rasterized.
+     */
+    uint32_t triangle_idx;
+    /**
+     * Where to count the fragments of the triangle, always valid even if
+     * the statistics are not requested.
+     */
+    struct draw_fragment_statistics *r_statistics;
+};
+
+typedef void (*mcc_rasterize_triangle_fn)(const struct mcc_rasterization_context*);
+
+enum raster_depth_test {
+    /**
+     * Uses the (optional) depth comparison function of the context.
+     */
+    RASTER_DEPTH_TEST_GENERIC,
+    RASTER_DEPTH_TEST_LT,
+    RASTER_DEPTH_TEST_LTE,
+    RASTER_DEPTH_TEST_EQ,
+};
+
+/**
+ * What is known about the draw when instantiating the rasterization
+ * functions, always given as a constant so that the compiler removes the
+ * checks and loops that depend on it.
+ */
+struct raster_variant {
+    enum raster_depth_test depth_test;
+    /**
+     * If true, the attachment has both a color and a depth attachment.
+     */
+    bool color_and_depth;
+    /**
+     * If negative, the `varying_count` of the context is used.
+     */
+    int varying_count;
+    /**
+     * If true, the draw is known to be depth only, otherwise it is if the
+     * context has no fragment shader.
+     */
+    bool depth_only;
+};
+
+static ALWAYS_INLINE size_t raster_variant_varying_count(struct raster_variant variant, const struct mcc_rasterization_context *r_context) {
+    return variant.varying_count >= 0 ? (size_t)variant.varying_count : r_context->varying_count;
+}
+
+static ALWAYS_INLINE bool raster_variant_depth_only(struct raster_variant variant, const struct mcc_rasterization_context *r_context) {
+    return variant.depth_only || !r_context->o_fragment_shader;
+}
+
+/**
+ * Returns false if the fragment must be discarded, assumes there is a depth
+ * attachment.
+ */
+static ALWAYS_INLINE bool raster_variant_depth_test(
+    struct raster_variant variant, const struct mcc_rasterization_context *r_context,
+    float previous, float new
+) {
+    switch (variant.depth_test) {
+    case RASTER_DEPTH_TEST_LT:
+        return new < previous;
+    case RASTER_DEPTH_TEST_LTE:
+        return new <= previous;
+    case RASTER_DEPTH_TEST_EQ:
+        return new == previous;
+    case RASTER_DEPTH_TEST_GENERIC:
+        break;
+    }
+    return !r_context->o_depth_comparison_fn || r_context->o_depth_comparison_fn(previous, new);
+}
+
+/**
+ * Index, in `r_coarse_dirty`, of the bit of the given coarse depth block.
+ */
+static inline uint32_t coarse_dirty_bit(const struct mcc_rasterization_context *r_context, uint32_t block_x, uint32_t block_y) {
+    return (block_x - r_context->tile_rect.min_x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE)
+         + (block_y - r_context->tile_rect.min_y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE) * TILE_COARSE_BLOCKS;
+}
+
+/**
+ * Triangle setup, computes the planes used to shade the fragments of the
+ * context's primitive.
+ */
+static ALWAYS_INLINE void triangle_setup_compute(const struct mcc_rasterization_context *r_context, struct raster_variant variant) {
+    const primitive_t *primitive = r_context->r_primitive;
+    struct triangle_setup *setup = r_context->r_setup;
+    const size_t varying_count = raster_variant_varying_count(variant, r_context);
+
+    const float w0 = primitive->v0.w_inv,
+                w1 = primitive->v1.w_inv,
+                w2 = primitive->v2.w_inv;
+    setup->w_inv = attribute_plane_setup(w0, w1, w2);
+    for (size_t varying_i = 0; varying_i < varying_count; varying_i++) {
+        struct varying_plane *plane = &setup->r_varyings[varying_i];
+        for (size_t component_i = 0; component_i < 4; component_i++) {
+            const struct attribute_plane component_plane = attribute_plane_setup(
+                primitive->v0.varyings[varying_i].vec4f.components[component_i] * w0,
+                primitive->v1.varyings[varying_i].vec4f.components[component_i] * w1,
+                primitive->v2.varyings[varying_i].vec4f.components[component_i] * w2
+            );
+            plane->base.components[component_i] = component_plane.base;
+            plane->du.components[component_i] = component_plane.du;
+            plane->dv.components[component_i] = component_plane.dv;
+        }
+    }
+}
+
+static ALWAYS_INLINE void process_fragment(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    const struct mcc_pixel_params *pixel
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    auto color_attachment = r_context->r_attachment->o_color;
+    const struct triangle_setup *setup = r_context->r_setup;
+    const float u = pixel->barycentric.u,
+                v = pixel->barycentric.v;
+    const size_t varying_count = raster_variant_varying_count(variant, r_context);
+    
+    // Interpolation of varying attributes
+    const float correction = 1.f / attribute_plane_eval(setup->w_inv, u, v);
+    for (size_t varying_i = 0; varying_i < varying_count; varying_i++) {
+        const struct varying_plane *plane = &setup->r_varyings[varying_i];
+        for (size_t component_i = 0; component_i < 4; component_i++) {
+            r_context->r_fragment_varyings[varying_i].vec4f.components[component_i] = correction * (
+                plane->base.components[component_i] +
+                u * plane->du.components[component_i] +
+                v * plane->dv.components[component_i]
+            );
+        }
+    }
+
+    // Execute the fragment shader
+    r_context->r_frag_input->in_frag_coord = (mcc_vec3f){{ pixel->screen_pos.x, pixel->screen_pos.y, pixel->depth }};
+    r_context->o_fragment_shader->r_fn(r_context->r_frag_input);
+    r_context->r_statistics->fragment_shader_invocations++;
 
     // Write depth if we have a depth attachment
-    if (depth_attachment) {
+    if (variant.color_and_depth || depth_attachment) {
         depth_attachment->r_data[pixel->pixel_idx] = pixel->depth;
     }
 
-    // Write color if we have a color attachment
-    if (color_attachment) {
-        color_attachment->r_data[pixel->pixel_idx*4+0] = (uint8_t)(r_context->r_frag_input->out_color.b * 255.f);
-        color_attachment->r_data[pixel->pixel_idx*4+1] = (uint8_t)(r_context->r_frag_input->out_color.g * 255.f);
-        color_attachment->r_data[pixel->pixel_idx*4+2] = (uint8_t)(r_context->r_frag_input->out_color.r * 255.f);
-        color_attachment->r_data[pixel->pixel_idx*4+3] = (uint8_t)(r_context->r_frag_input->out_color.a * 255.f);
+    // Write color if we have a color attachment
+    if (variant.color_and_depth || color_attachment) {
+        color_attachment->r_data[pixel->pixel_idx*4+0] = (uint8_t)(r_context->r_frag_input->out_color.b * 255.f);
+        color_attachment->r_data[pixel->pixel_idx*4+1] = (uint8_t)(r_context->r_frag_input->out_color.g * 255.f);
+        color_attachment->r_data[pixel->pixel_idx*4+2] = (uint8_t)(r_context->r_frag_input->out_color.r * 255.f);
+        color_attachment->r_data[pixel->pixel_idx*4+3] = (uint8_t)(r_context->r_frag_input->out_color.a * 255.f);
+    }
+}
+
+static ALWAYS_INLINE void process_fragment_packet(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    const struct mcc_pixel_packet_params *packet
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    auto color_attachment = r_context->r_attachment->o_color;
+    const struct triangle_setup *setup = r_context->r_setup;
+    struct mcc_cpurast_fragment_packet_input *input = r_context->r_frag_packet_input;
+    const size_t varying_count = raster_variant_varying_count(variant, r_context);
+
+    // Perspective correction of each lane
+    float corrections[MCC_SIMD_WIDTH];
+    for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++)
+        corrections[lane] = 1.f / attribute_plane_eval(setup->w_inv, packet->u[lane], packet->v[lane]);
+
+    // Interpolation of varying attributes
+    for (size_t varying_i = 0; varying_i < varying_count; varying_i++) {
+        const struct varying_plane *plane = &setup->r_varyings[varying_i];
+        for (size_t component_i = 0; component_i < 4; component_i++) {
+            const float base = plane->base.components[component_i],
+                        du = plane->du.components[component_i],
+                        dv = plane->dv.components[component_i];
+            float *out = input->r_in_varyings[varying_i][component_i];
+            for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++)
+                out[lane] = corrections[lane] * (base + packet->u[lane] * du + packet->v[lane] * dv);
+        }
+    }
+
+    // Execute the fragment shader
+    const struct pixel_to_ndc to_ndc = viewport_pixel_to_ndc(&r_context->viewport);
+    for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+        input->in_frag_coord[0][lane] = (float)(packet->x + lane) * to_ndc.scale_x + to_ndc.offset_x;
+        input->in_frag_coord[1][lane] = (float)packet->y * to_ndc.scale_y + to_ndc.offset_y;
+        input->in_frag_coord[2][lane] = packet->depth[lane];
+    }
+    input->in_active_mask = packet->mask;
+    r_context->o_fragment_shader->o_packet_fn(input);
+    r_context->r_statistics->fragment_shader_invocations += stdc_count_ones(packet->mask);
+
+    const size_t row_idx = attachment_pixel_idx(r_context->r_attachment, packet->x, packet->y);
+    for (uint32_t mask = packet->mask; mask; mask &= mask - 1) {
+        const uint32_t lane = stdc_trailing_zeros(mask);
+        const size_t pixel_idx = row_idx + lane;
+
+        // Write depth if we have a depth attachment
+        if (variant.color_and_depth || depth_attachment) {
+            depth_attachment->r_data[pixel_idx] = packet->depth[lane];
+        }
+
+        // Write color if we have a color attachment
+        if (variant.color_and_depth || color_attachment) {
+            color_attachment->r_data[pixel_idx*4+0] = (uint8_t)(input->out_color[2][lane] * 255.f);
+            color_attachment->r_data[pixel_idx*4+1] = (uint8_t)(input->out_color[1][lane] * 255.f);
+            color_attachment->r_data[pixel_idx*4+2] = (uint8_t)(input->out_color[0][lane] * 255.f);
+            color_attachment->r_data[pixel_idx*4+3] = (uint8_t)(input->out_color[3][lane] * 255.f);
+        }
+    }
+}
+
+/**
+ * Keeps the fragments of the packet in the visibility buffer to shade them
+ * later, their depth is final so it is written right away.
+ */
+static ALWAYS_INLINE void write_visibility(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    const struct mcc_pixel_packet_params *packet, bool swapped
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    struct tile_visibility *visibility = r_context->o_visibility;
+    const uint32_t triangle = r_context->triangle_idx | (swapped ? VISIBILITY_SWAPPED : 0);
+    const size_t row_idx = attachment_pixel_idx(r_context->r_attachment, packet->x, packet->y);
+    const size_t tile_row_idx = (packet->x - r_context->tile_rect.min_x)
+                              + (packet->y - r_context->tile_rect.min_y) * TILE_SIZE;
+
+    for (uint32_t mask = packet->mask; mask; mask &= mask - 1) {
+        const uint32_t lane = stdc_trailing_zeros(mask);
+        const size_t tile_pixel_idx = tile_row_idx + lane;
+
+        visibility->triangles[tile_pixel_idx] = triangle;
+        visibility->u[tile_pixel_idx] = packet->u[lane];
+        visibility->v[tile_pixel_idx] = packet->v[lane];
+        visibility->depth[tile_pixel_idx] = packet->depth[lane];
+
+        if (variant.color_and_depth || depth_attachment)
+            depth_attachment->r_data[row_idx + lane] = packet->depth[lane];
+    }
+}
+
+/**
+ * Outputs the fragments of the packet that passed the depth test: only their
+ * depth is written for depth only draws, they are kept in the visibility
+ * buffer with deferred shading, and shaded otherwise (the shading setup of
+ * the triangle being done by the first call, see `r_setup_done`).
+ */
+static ALWAYS_INLINE void output_packet(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct mcc_pixel_packet_params *packet, bool swapped, bool *r_setup_done
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    const primitive_t *primitive = r_context->r_primitive;
+    const size_t row_idx = attachment_pixel_idx(r_context->r_attachment, packet->x, packet->y);
+
+    if (raster_variant_depth_only(variant, r_context)) {
+        if (variant.color_and_depth || depth_attachment)
+            mcc_f32x8_masked_store(&depth_attachment->r_data[row_idx], mcc_f32x8_load(packet->depth), packet->mask);
+        return;
+    }
+
+    if (r_context->o_visibility) {
+        write_visibility(r_context, variant, packet, swapped);
+        return;
+    }
+
+    if (!*r_setup_done) {
+        triangle_setup_compute(r_context, variant);
+        *r_setup_done = true;
+    }
+
+    if (r_context->o_fragment_shader->o_packet_fn) {
+        // Lanes that are not part of the packet must still have finite values
+        const float v0_depth = primitive->v0.pos_homogeneous.z * primitive->v0.w_inv;
+        for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+            if (!(packet->mask & (1u << lane))) {
+                packet->u[lane] = packet->v[lane] = 0.f;
+                packet->depth[lane] = v0_depth;
+            }
+        }
+        process_fragment_packet(r_context, variant, packet);
+        return;
+    }
+
+    const struct pixel_to_ndc to_ndc = viewport_pixel_to_ndc(&r_context->viewport);
+    for (uint32_t mask = packet->mask; mask; mask &= mask - 1) {
+        const uint32_t lane = stdc_trailing_zeros(mask);
+        const uint32_t px = packet->x + lane;
+
+        // Process this fragment
+        struct mcc_pixel_params pixel = {
+            .barycentric = {
+                .u = packet->u[lane],
+                .v = packet->v[lane],
+            },
+            .screen_pos = {{
+                (float)px * to_ndc.scale_x + to_ndc.offset_x,
+                (float)packet->y * to_ndc.scale_y + to_ndc.offset_y,
+            }},
+            .depth = packet->depth[lane],
+            .pixel_idx = row_idx + lane,
+        };
+        process_fragment(r_context, variant, &pixel);
+    }
+}
+
+/**
+ * State of the rasterization of a triangle in the LINE and POINT polygon
+ * modes, whose fragments are gathered by rows of MCC_SIMD_WIDTH pixels
+ * before being output.
+ */
+struct outline_raster_state {
+    /**
+     * Fragments that passed the depth test but are not output yet.
+     */
+    struct mcc_pixel_packet_params packet;
+    struct attribute_plane depth_plane;
+    /**
+     * Pixels whose center may be covered by the triangle, the outline is
+     * kept inside of them so that it only touches the tiles the triangle is
+     * binned in.
+     */
+    struct pixel_range range;
+    /**
+     * Pixels of the current tile inside of the scissor, the only ones
+     * written.
+     */
+    struct pixel_rect clip;
+    bool swapped;
+    bool setup_done;
+};
+
+static ALWAYS_INLINE void outline_flush(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct outline_raster_state *r_state
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    if (!r_state->packet.mask)
+        return;
+
+    r_context->r_statistics->samples_passed += stdc_count_ones(r_state->packet.mask);
+    output_packet(r_context, variant, &r_state->packet, r_state->swapped, &r_state->setup_done);
+    if ((variant.color_and_depth || depth_attachment) && depth_attachment->o_coarse_data) {
+        const uint32_t block_x = r_state->packet.x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE,
+                       block_y = r_state->packet.y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE;
+        *r_context->r_coarse_dirty |= 1ull << coarse_dirty_bit(r_context, block_x, block_y);
+    }
+    r_state->packet.mask = 0;
+}
+
+/**
+ * Depth tests the fragment of the triangle at pixel (x, y) and adds it to
+ * the pending packet if it passes, nothing is done if the pixel is not in
+ * the current tile or outside of the scissor.
+ */
+static ALWAYS_INLINE void outline_fragment(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct outline_raster_state *r_state,
+    uint32_t x, uint32_t y, struct mcc_barycentric_coords barycentric
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    const struct pixel_rect clip = r_state->clip;
+    if (x < clip.min_x || x >= clip.max_x || y < clip.min_y || y >= clip.max_y)
+        return;
+
+    // The pending fragments must be written before testing one of their
+    // pixels again
+    const uint32_t lane = x % MCC_SIMD_WIDTH;
+    if (r_state->packet.x != x - lane || r_state->packet.y != y || r_state->packet.mask & (1u << lane))
+        outline_flush(r_context, variant, r_state);
+    r_state->packet.x = x - lane;
+    r_state->packet.y = y;
+
+    const float depth = fragment_depth(r_state->depth_plane, barycentric.u, barycentric.v);
+    r_context->r_statistics->depth_tested_fragments++;
+    if (
+        (variant.color_and_depth || depth_attachment) &&
+        !raster_variant_depth_test(variant, r_context, depth_attachment->r_data[attachment_pixel_idx(r_context->r_attachment, x, y)], depth)
+    ) {
+        return;
+    }
+
+    r_state->packet.mask |= 1u << lane;
+    r_state->packet.u[lane] = barycentric.u;
+    r_state->packet.v[lane] = barycentric.v;
+    r_state->packet.depth[lane] = depth;
+}
+
+/**
+ * Barycentric coordinates of each vertex of a triangle.
+ */
+static const struct mcc_barycentric_coords vertex_barycentrics[3] = {
+    { .u = 0.f, .v = 0.f },
+    { .u = 1.f, .v = 0.f },
+    { .u = 0.f, .v = 1.f },
+};
+
+/**
+ * Rasterizes the edge of the triangle from vertex `a` to vertex `b` with an
+ * integer DDA along its major axis: for each column (or row) of pixels whose
+ * center is between the two vertices, the pixel containing the point of the
+ * edge at this center.
+ */
+static ALWAYS_INLINE void rasterize_edge(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct outline_raster_state *r_state, const struct fixed_point_triangle *r_tri,
+    size_t a, size_t b
+) {
+    const int64_t dx = r_tri->x[b] - r_tri->x[a],
+                  dy = r_tri->y[b] - r_tri->y[a];
+    const bool x_major = (dx < 0 ? -dx : dx) >= (dy < 0 ? -dy : dy);
+    // Coordinates along the major and the minor axis
+    const int64_t *major = x_major ? r_tri->x : r_tri->y,
+                  *minor = x_major ? r_tri->y : r_tri->x;
+    if (major[a] > major[b]) {
+        const size_t t = a;
+        a = b;
+        b = t;
+    }
+    const int64_t major_delta = major[b] - major[a],
+                  minor_delta = minor[b] - minor[a];
+    assert(major_delta > 0);
+
+    const struct pixel_range range = r_state->range;
+    const struct pixel_rect clip = r_state->clip;
+    const int64_t major_min = x_major ? mcc_max(range.min_x, (int64_t)clip.min_x) : mcc_max(range.min_y, (int64_t)clip.min_y),
+                  major_max = x_major ? mcc_min(range.max_x, (int64_t)clip.max_x) : mcc_min(range.max_y, (int64_t)clip.max_y),
+                  minor_min = x_major ? range.min_y : range.min_x,
+                  minor_max = x_major ? range.max_y : range.max_x;
+
+    // Pixels whose center is in [major[a], major[b]]
+    const int64_t start = mcc_max(-floor_div_i64(SUBPIXEL_ONE / 2 - major[a], SUBPIXEL_ONE), major_min),
+                  end = mcc_min(floor_div_i64(major[b] - SUBPIXEL_ONE / 2, SUBPIXEL_ONE) + 1, major_max);
+    if (start >= end)
+        return;
+
+    // Minor pixel of the edge at the center `c` of the major pixel:
+    // floor((minor[a] * major_delta + (c - major[a]) * minor_delta) / den),
+    // kept as a quotient and a remainder stepped along the major axis
+    const int64_t den = major_delta * SUBPIXEL_ONE;
+    const int64_t start_center = start * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+    const int64_t start_num = minor[a] * major_delta + (start_center - major[a]) * minor_delta;
+    int64_t quot = floor_div_i64(start_num, den),
+            rem = start_num - quot * den;
+    const int64_t step = minor_delta * SUBPIXEL_ONE;
+    const int64_t step_quot = floor_div_i64(step, den),
+                  step_rem = step - step_quot * den;
+
+    const struct mcc_barycentric_coords from = vertex_barycentrics[a],
+                                        to = vertex_barycentrics[b];
+    const float t_step = (float)SUBPIXEL_ONE / (float)major_delta;
+    float t = (float)(start_center - major[a]) / (float)major_delta;
+
+    for (int64_t m = start; m < end; m++) {
+        // Kept in the range as the edge may be exactly on the border of a
+        // pixel outside of it (pixels outside of the scissor are then
+        // dropped by `outline_fragment`)
+        const int64_t n = mcc_min(mcc_max(quot, minor_min), minor_max - 1);
+        const struct mcc_barycentric_coords barycentric = {
+            .u = from.u + t * (to.u - from.u),
+            .v = from.v + t * (to.v - from.v),
+        };
+        outline_fragment(
+            r_context, variant, r_state,
+            (uint32_t)(x_major ? m : n), (uint32_t)(x_major ? n : m),
+            barycentric
+        );
+
+        quot += step_quot;
+        rem += step_rem;
+        if (rem >= den) {
+            rem -= den;
+            quot++;
+        }
+        t += t_step;
+    }
+}
+
+/**
+ * Rasterizes the edges (LINE polygon mode) or the vertices (POINT polygon
+ * mode) of the triangle set up by `rasterize_triangle`, only the fragments
+ * on them are depth tested and shaded.
+ */
+static ALWAYS_INLINE void rasterize_triangle_outline(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    const struct fixed_point_triangle *r_tri, struct pixel_rect clip,
+    struct attribute_plane depth_plane, bool swapped
+) {
+    struct outline_raster_state state = {
+        .depth_plane = depth_plane,
+        .range = fixed_point_triangle_range(r_tri),
+        .clip = clip,
+        .swapped = swapped,
+    };
+
+    if (r_context->polygon_mode == MCC_CPURAST_POLYGON_MODE_LINE) {
+        rasterize_edge(r_context, variant, &state, r_tri, 0, 1);
+        rasterize_edge(r_context, variant, &state, r_tri, 1, 2);
+        rasterize_edge(r_context, variant, &state, r_tri, 2, 0);
+    } else {
+        // The pixel containing each vertex
+        for (size_t vertex_i = 0; vertex_i < 3; vertex_i++) {
+            const int64_t x = floor_div_i64(r_tri->x[vertex_i], SUBPIXEL_ONE),
+                          y = floor_div_i64(r_tri->y[vertex_i], SUBPIXEL_ONE);
+            outline_fragment(
+                r_context, variant, &state,
+                (uint32_t)mcc_min(mcc_max(x, state.range.min_x), state.range.max_x - 1),
+                (uint32_t)mcc_min(mcc_max(y, state.range.min_y), state.range.max_y - 1),
+                vertex_barycentrics[vertex_i]
+            );
+        }
+    }
+    outline_flush(r_context, variant, &state);
+}
+
+/**
+ * What is computed once for each triangle to rasterize it in
+ * `rasterize_triangle`.
+ */
+struct triangle_raster_setup {
+    struct edge_equation edges[3];
+    /**
+     * Edge functions offsets of each lane from the first one.
+     */
+    mcc_i64x8 edge_lane_offsets[3];
+    /**
+     * Lanes whose edge function is greater are inside.
+     */
+    mcc_i64x8 edge_thresholds[3];
+    float area_inv;
+    struct attribute_plane depth_plane;
+    /**
+     * Nearest depth of the triangle minus COARSE_DEPTH_EPSILON.
+     */
+    float min_depth;
+    bool swapped;
+    /**
+     * The shading setup is only done once the triangle has a fragment to
+     * shade.
+     */
+    bool shading_setup_done;
+};
+
+/**
+ * Computes the edge functions of the row of MCC_SIMD_WIDTH pixels at (x, y)
+ * and returns the mask of the lanes inside of the triangle.
+ */
+static ALWAYS_INLINE uint32_t triangle_row_coverage(
+    const struct triangle_raster_setup *r_setup, uint32_t x, uint32_t y,
+    mcc_i64x8 r_edge_values[3]
+) {
+    uint32_t coverage = (1u << MCC_SIMD_WIDTH) - 1u;
+    for (size_t edge_i = 0; edge_i < 3; edge_i++) {
+        r_edge_values[edge_i] = mcc_i64x8_add(
+            mcc_i64x8_splat(edge_equation_eval(r_setup->edges[edge_i], x, y)),
+            r_setup->edge_lane_offsets[edge_i]
+        );
+        coverage &= mcc_i64x8_gt_mask(r_edge_values[edge_i], r_setup->edge_thresholds[edge_i]);
+    }
+    return coverage;
+}
+
+/**
+ * Mask of the lanes of a row of MCC_SIMD_WIDTH pixels starting at `x` which
+ * are inside of the columns of `rect`.
+ */
+static inline uint32_t rect_lane_mask(struct pixel_rect rect, uint32_t x) {
+    uint32_t lane_mask = (1u << MCC_SIMD_WIDTH) - 1u;
+    if (x < rect.min_x)
+        lane_mask &= ~((1u << (rect.min_x - x)) - 1u);
+    if (rect.max_x - x < MCC_SIMD_WIDTH)
+        lane_mask &= (1u << (rect.max_x - x)) - 1u;
+    return lane_mask;
+}
+
+/**
+ * Hierarchical depth test: returns true if the farthest depth of the coarse
+ * block is nearer than the nearest point of the triangle, so that none of
+ * its fragments in the block can pass the depth test (equal depths included
+ * for lte and eq). The coarse depth of the block is refreshed if needed.
+ */
+static ALWAYS_INLINE bool coarse_block_hidden(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    const struct triangle_raster_setup *r_setup, uint32_t block_x, uint32_t block_y
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    float32_t *coarse_data = variant.color_and_depth || depth_attachment ? depth_attachment->o_coarse_data : NULL;
+    const bool hierarchical_depth_test = coarse_data && (
+        variant.depth_test != RASTER_DEPTH_TEST_GENERIC ||
+        r_context->o_depth_comparison_fn == mcc_depth_comparison_fn_lt ||
+        r_context->o_depth_comparison_fn == mcc_depth_comparison_fn_lte ||
+        r_context->o_depth_comparison_fn == mcc_depth_comparison_fn_eq
+    );
+    if (!hierarchical_depth_test)
+        return false;
+    const bool inclusive = variant.depth_test == RASTER_DEPTH_TEST_GENERIC
+        ? r_context->o_depth_comparison_fn == mcc_depth_comparison_fn_lte ||
+          r_context->o_depth_comparison_fn == mcc_depth_comparison_fn_eq
+        : variant.depth_test != RASTER_DEPTH_TEST_LT;
+
+    const uint32_t dirty_bit = coarse_dirty_bit(r_context, block_x, block_y);
+    if (*r_context->r_coarse_dirty & (1ull << dirty_bit)) {
+        coarse_depth_refresh(r_context->r_attachment, block_x, block_y);
+        *r_context->r_coarse_dirty &= ~(1ull << dirty_bit);
+    }
+    const uint32_t coarse_width = mcc_up_div(r_context->r_attachment->width, MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE);
+    const float block_max_depth = coarse_data[block_x + block_y * coarse_width];
+    return inclusive ? r_setup->min_depth > block_max_depth : r_setup->min_depth >= block_max_depth;
+}
+
+/**
+ * Depth tests the pixels (whose bit is set in `coverage`) of the row of
+ * MCC_SIMD_WIDTH pixels at (x, y), whose edge functions are `edge_values`,
+ * and outputs the fragments that pass.
+ * Returns true if fragments were written.
+ */
+static ALWAYS_INLINE bool rasterize_row(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct triangle_raster_setup *r_setup, uint32_t x, uint32_t y, uint32_t coverage,
+    const mcc_i64x8 edge_values[3]
+) {
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    r_context->r_statistics->depth_tested_fragments += stdc_count_ones(coverage);
+
+    int64_t lane_values[2][MCC_SIMD_WIDTH];
+    for (size_t edge_i = 0; edge_i < 2; edge_i++)
+        mcc_i64x8_store(lane_values[edge_i], edge_values[edge_i]);
+
+    struct mcc_pixel_packet_params packet = {
+        .x = x,
+        .y = y,
+        .mask = 0,
+    };
+    const size_t row_idx = attachment_pixel_idx(r_context->r_attachment, x, y);
+    for (; coverage; coverage &= coverage - 1) {
+        const uint32_t lane = stdc_trailing_zeros(coverage);
+        size_t pixel_idx = row_idx + lane;
+
+        const struct mcc_barycentric_coords barycentric = {
+            .u = (float)lane_values[0][lane] * r_setup->area_inv,
+            .v = (float)lane_values[1][lane] * r_setup->area_inv,
+        };
+
+        // Calculate depth using barycentric coordinates
+        float depth = fragment_depth(r_setup->depth_plane, barycentric.u, barycentric.v);
+
+        // Depth comparison function test
+        if (
+            (variant.color_and_depth || depth_attachment) &&
+            !raster_variant_depth_test(variant, r_context, depth_attachment->r_data[pixel_idx], depth)
+        ) {
+            continue;
+        }
+
+        packet.mask |= 1u << lane;
+        packet.u[lane] = barycentric.u;
+        packet.v[lane] = barycentric.v;
+        packet.depth[lane] = depth;
+    }
+    if (!packet.mask)
+        return false;
+    r_context->r_statistics->samples_passed += stdc_count_ones(packet.mask);
+    output_packet(r_context, variant, &packet, r_setup->swapped, &r_setup->shading_setup_done);
+    return true;
+}
+
+/**
+ * Rasterizes a triangle whose pixels in `rect` (the pixels of the tile it
+ * may cover) fit in a single column of coarse blocks and at most
+ * SMALL_TRIANGLE_MAX_ROWS rows.
+ * The coverage of the whole rect is computed first, so that triangles
+ * covering no pixel center are dropped before any depth test.
+ */
+static ALWAYS_INLINE void rasterize_small_triangle(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    struct triangle_raster_setup *r_setup, struct pixel_rect rect
+) {
+    static_assert(SMALL_TRIANGLE_MAX_ROWS * MCC_SIMD_WIDTH <= 64);
+    auto depth_attachment = r_context->r_attachment->o_depth;
+    const uint32_t x = rect.min_x / MCC_SIMD_WIDTH * MCC_SIMD_WIDTH;
+    const uint32_t row_count = rect.max_y - rect.min_y;
+    const uint32_t lane_mask = rect_lane_mask(rect, x);
+
+    // One byte for each row
+    uint64_t coverage = 0;
+    mcc_i64x8 edge_values[SMALL_TRIANGLE_MAX_ROWS][3];
+    for (uint32_t row_i = 0; row_i < row_count; row_i++) {
+        const uint32_t row_coverage = lane_mask & triangle_row_coverage(r_setup, x, rect.min_y + row_i, edge_values[row_i]);
+        coverage |= (uint64_t)row_coverage << (row_i * MCC_SIMD_WIDTH);
+    }
+    if (!coverage)
+        return;
+
+    float32_t *coarse_data = variant.color_and_depth || depth_attachment ? depth_attachment->o_coarse_data : NULL;
+    const uint32_t block_x = x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE;
+    // The rows can span two blocks
+    uint32_t block_y = UINT32_MAX;
+    bool block_hidden = false;
+
+    for (uint32_t row_i = 0; row_i < row_count; row_i++) {
+        const uint32_t row_coverage = (uint32_t)(coverage >> (row_i * MCC_SIMD_WIDTH)) & ((1u << MCC_SIMD_WIDTH) - 1u);
+        if (!row_coverage)
+            continue;
+        const uint32_t y = rect.min_y + row_i;
+        if (y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE != block_y) {
+            block_y = y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE;
+            block_hidden = coarse_block_hidden(r_context, variant, r_setup, block_x, block_y);
+        }
+        if (block_hidden)
+            continue;
+
+        if (rasterize_row(r_context, variant, r_setup, x, y, row_coverage, edge_values[row_i]) && coarse_data)
+            *r_context->r_coarse_dirty |= 1ull << coarse_dirty_bit(r_context, block_x, block_y);
     }
 }
 
-static void rasterize_triangle(const struct mcc_rasterization_context *r_context) {
+/**
+ * Only called with a constant `variant`, through the functions instantiated
+ * with `DEFINE_RASTERIZE_TRIANGLE`.
+ */
+static ALWAYS_INLINE void rasterize_triangle(const struct mcc_rasterization_context *r_context, struct raster_variant variant) {
     auto depth_attachment = r_context->r_attachment->o_depth;
     primitive_t *primitive = r_context->r_primitive;
 
@@ -426,413 +1842,1788 @@ static void rasterize_triangle(const struct mcc_rasterization_context *r_context
     mcc_vec3f v0 = mcc_vec3f_scale(primitive->v0.pos_homogeneous.xyz, primitive->v0.w_inv),
               v1 = mcc_vec3f_scale(primitive->v1.pos_homogeneous.xyz, primitive->v1.w_inv),
               v2 = mcc_vec3f_scale(primitive->v2.pos_homogeneous.xyz, primitive->v2.w_inv);
-    mcc_vec2f p0 = v0.xy,
-              p1 = v1.xy,
-              p2 = v2.xy;
 
-    mcc_vec2f p1p0 = mcc_vec2f_sub(p1, p0);
-    mcc_vec2f p2p1 = mcc_vec2f_sub(p2, p1);
-    mcc_vec2f p0p2 = mcc_vec2f_sub(p0, p2);
-    mcc_vec2f p2p0 = mcc_vec2f_sub(p2, p0);
-    float det012 = mcc_mat2f_det(mcc_mat2f_col(p1p0, p2p0));
+    struct fixed_point_triangle tri;
+    // Triangles are clipped against the guard band so they fit, only
+    // degenerate ones (with NaN positions) are dropped here
+    if (!fixed_point_triangle_setup(v0.xy, v1.xy, v2.xy, &r_context->viewport, &tri))
+        return;
+
+    // Twice the area of the triangle, positive for the triangles that are
+    // counter clockwise in normalized device coordinates
+    // (the value of the edge function v0 -> v1 at v2)
+    int64_t area = (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0])
+                 - (tri.y[2] - tri.y[0]) * (tri.x[1] - tri.x[0]);
+    if (area == 0)
+        return;
 
-    bool isCcw = det012 < 0.f;
+    bool isCcw = area < 0;
 
     if ((r_context->culling_mode == MCC_CPURAST_CULLING_MODE_CW && isCcw) ||
         (r_context->culling_mode == MCC_CPURAST_CULLING_MODE_CCW && !isCcw))
         return;
 
-    // TODO
-    // if (r_context->culling_mode != MCC_CPURAST_CULLING_MODE_CCW && isCcw) {
-    //     mcc_vec2f t2 = p1;
-    //     p1 = p2;
-    //     p2 = t2;
-    //     mcc_vec3f t3 = v1;
-    //     v1 = v2;
-    //     v2 = t3;
-    //     struct processed_vertex tv = primitive->v1;
-    //     primitive->v1 = primitive->v2;
-    //     primitive->v2 = tv;
-    // }
-
-    // Screen dimensions as floats
-    float wf = (float)r_context->r_attachment->width;
-    float hf = (float)r_context->r_attachment->height;
-
-    // AABB of the triangle in viewport coordinate
-    float min_xf = clampf(min3f(p0.x, p1.x, p2.x), -1.f, 1.f);
-    float min_yf = clampf(min3f(p0.y, p1.y, p2.y), -1.f, 1.f);
-    float max_xf = clampf(max3f(p0.x, p1.x, p2.x), -1.f, 1.f);
-    float max_yf = clampf(max3f(p0.y, p1.y, p2.y), -1.f, 1.f);
-
-    // AABB of the triangle in screen coordinate
-    // NOTE: Since y is inverted we need to take the min pos to have the max pixel
-    uint32_t min_x = (uint32_t)(( min_xf + 1.f) * 0.5f * wf - 0.5f);
-    uint32_t min_y = (uint32_t)((-max_yf + 1.f) * 0.5f * hf - 0.5f);
-    uint32_t max_x = (uint32_t)(( max_xf + 1.f) * 0.5f * wf + 0.5f);
-    uint32_t max_y = (uint32_t)((-min_yf + 1.f) * 0.5f * hf + 0.5f);
-
-    assert(max_x <= r_context->r_attachment->width);
-    assert(max_y <= r_context->r_attachment->height);
-    assert(min_x <= max_x);
-    assert(min_y <= max_y);
-
-    // Iterate over pixels
-    for (uint32_t y = min_y; y < max_y; y++) {
-        for (uint32_t x = min_x; x < max_x; x++) {
-            size_t pixel_idx = x + y * r_context->r_attachment->width;
+    // Swap two vertices so that the edge functions are positive inside of
+    // the triangle whatever its winding
+    if (area < 0) {
+        struct processed_vertex tv = primitive->v1;
+        primitive->v1 = primitive->v2;
+        primitive->v2 = tv;
+        mcc_vec3f t3 = v1;
+        v1 = v2;
+        v2 = t3;
+        int64_t tx = tri.x[1], ty = tri.y[1];
+        tri.x[1] = tri.x[2]; tri.y[1] = tri.y[2];
+        tri.x[2] = tx;       tri.y[2] = ty;
+        area = -area;
+    }
+
+    struct pixel_rect bounds = fixed_point_triangle_bounds(&tri, &r_context->viewport);
+    // Only rasterize the part of the triangle inside the current tile
+    uint32_t min_x = mcc_max(bounds.min_x, r_context->tile_rect.min_x);
+    uint32_t min_y = mcc_max(bounds.min_y, r_context->tile_rect.min_y);
+    uint32_t max_x = mcc_min(bounds.max_x, r_context->tile_rect.max_x);
+    uint32_t max_y = mcc_min(bounds.max_y, r_context->tile_rect.max_y);
+    if (min_x >= max_x || min_y >= max_y)
+        return;
+
+    if (r_context->polygon_mode != MCC_CPURAST_POLYGON_MODE_FILL) {
+        const struct pixel_rect clip = { .min_x = min_x, .min_y = min_y, .max_x = max_x, .max_y = max_y };
+        rasterize_triangle_outline(r_context, variant, &tri, clip, attribute_plane_setup(v0.z, v1.z, v2.z), isCcw);
+        return;
+    }
+
+    struct triangle_raster_setup setup = {
+        // Edge functions (the barycentric coordinates before the division by
+        // the area), order matches the one of barycentric weights
+        .edges = {
+            /* u */ edge_equation_setup(&tri, 2, 0),
+            /* v */ edge_equation_setup(&tri, 0, 1),
+            /* w */ edge_equation_setup(&tri, 1, 2),
+        },
+        .area_inv = 1.f / (float)area,
+        .depth_plane = attribute_plane_setup(v0.z, v1.z, v2.z),
+        .min_depth = mcc_min(v0.z, mcc_min(v1.z, v2.z)) - COARSE_DEPTH_EPSILON,
+        .swapped = isCcw,
+    };
+    for (size_t edge_i = 0; edge_i < 3; edge_i++) {
+        setup.edge_lane_offsets[edge_i] = mcc_i64x8_lane_multiples(edge_equation_step_x(setup.edges[edge_i]));
+        setup.edge_thresholds[edge_i] = mcc_i64x8_splat(setup.edges[edge_i].threshold - 1);
+    }
+
+    // Most triangles of distant geometry only cover a few pixels
+    const struct pixel_rect rect = { min_x, min_y, max_x, max_y };
+    if (max_x - min_x / MCC_SIMD_WIDTH * MCC_SIMD_WIDTH <= MCC_SIMD_WIDTH && max_y - min_y <= SMALL_TRIANGLE_MAX_ROWS) {
+        rasterize_small_triangle(r_context, variant, &setup, rect);
+        return;
+    }
+
+    float32_t *coarse_data = variant.color_and_depth || depth_attachment ? depth_attachment->o_coarse_data : NULL;
+
+    // Iterate over the blocks of the coarse depth buffer covered by the
+    // triangle, each row of a block being exactly MCC_SIMD_WIDTH pixels
+    for (uint32_t block_y = min_y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE; block_y * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE < max_y; block_y++) {
+        for (uint32_t block_x = min_x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE; block_x * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE < max_x; block_x++) {
+            const uint32_t block_min_x = block_x * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE,
+                           block_min_y = block_y * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE;
+
+            if (coarse_block_hidden(r_context, variant, &setup, block_x, block_y))
+                continue;
+
+            const uint32_t lane_mask = rect_lane_mask(rect, block_min_x);
+            bool block_written = false;
+            const uint32_t block_max_y = mcc_min(block_min_y + MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE, max_y);
+            for (uint32_t y = mcc_max(block_min_y, min_y); y < block_max_y; y++) {
+                mcc_i64x8 edge_values[3];
+                const uint32_t coverage = lane_mask & triangle_row_coverage(&setup, block_min_x, y, edge_values);
+                if (!coverage)
+                    continue;
+                block_written |= rasterize_row(r_context, variant, &setup, block_min_x, y, coverage, edge_values);
+            }
+
+            if (block_written && coarse_data)
+                *r_context->r_coarse_dirty |= 1ull << coarse_dirty_bit(r_context, block_x, block_y);
+        }
+    }
+}
+
+/**
+ * Shades the pixels (whose bit is set in `mask`) of the row of MCC_SIMD_WIDTH
+ * pixels at (x, y) from the visibility buffer, they must all be covered by
+ * the triangle in the rasterization context's primitive.
+ */
+static ALWAYS_INLINE void shade_visibility(
+    const struct mcc_rasterization_context *r_context, struct raster_variant variant,
+    uint32_t x, uint32_t y, uint32_t mask
+) {
+    const struct tile_visibility *visibility = r_context->o_visibility;
+    const primitive_t *primitive = r_context->r_primitive;
+    const size_t tile_row_idx = (x - r_context->tile_rect.min_x)
+                              + (y - r_context->tile_rect.min_y) * TILE_SIZE;
+
+    if (r_context->o_fragment_shader->o_packet_fn) {
+        struct mcc_pixel_packet_params packet = {
+            .x = x,
+            .y = y,
+            .mask = mask,
+        };
+        const float v0_depth = primitive->v0.pos_homogeneous.z * primitive->v0.w_inv;
+        for (uint32_t lane = 0; lane < MCC_SIMD_WIDTH; lane++) {
+            // Lanes that are not part of the packet must still have finite
+            // values
+            if (!(mask & (1u << lane))) {
+                packet.u[lane] = packet.v[lane] = 0.f;
+                packet.depth[lane] = v0_depth;
+                continue;
+            }
+            packet.u[lane] = visibility->u[tile_row_idx + lane];
+            packet.v[lane] = visibility->v[tile_row_idx + lane];
+            packet.depth[lane] = visibility->depth[tile_row_idx + lane];
+        }
+        process_fragment_packet(r_context, variant, &packet);
+        return;
+    }
+
+    const struct pixel_to_ndc to_ndc = viewport_pixel_to_ndc(&r_context->viewport);
+    const size_t row_idx = attachment_pixel_idx(r_context->r_attachment, x, y);
+    for (; mask; mask &= mask - 1) {
+        const uint32_t lane = stdc_trailing_zeros(mask);
+        const uint32_t px = x + lane;
+
+        struct mcc_pixel_params pixel = {
+            .barycentric = {
+                .u = visibility->u[tile_row_idx + lane],
+                .v = visibility->v[tile_row_idx + lane],
+            },
+            .screen_pos = {{
+                (float)px * to_ndc.scale_x + to_ndc.offset_x,
+                (float)y * to_ndc.scale_y + to_ndc.offset_y,
+            }},
+            .depth = visibility->depth[tile_row_idx + lane],
+            .pixel_idx = row_idx + lane,
+        };
+        process_fragment(r_context, variant, &pixel);
+    }
+}
+
+typedef void (*mcc_triangle_setup_fn)(const struct mcc_rasterization_context*);
+typedef void (*mcc_shade_visibility_fn)(const struct mcc_rasterization_context*, uint32_t x, uint32_t y, uint32_t mask);
+
+/**
+ * Functions specialized for a `struct raster_variant`.
+ */
+struct raster_kernel {
+    mcc_rasterize_triangle_fn rasterize_triangle;
+    mcc_triangle_setup_fn triangle_setup;
+    mcc_shade_visibility_fn shade_visibility;
+};
+
+/**
+ * Defines a `struct raster_kernel` named `NAME` for the given
+ * `struct raster_variant`.
+ */
+#define DEFINE_RASTER_KERNEL(NAME, ...) \
+    static void NAME##_rasterize_triangle(const struct mcc_rasterization_context *r_context) { \
+        rasterize_triangle(r_context, (struct raster_variant){ __VA_ARGS__ }); \
+    } \
+    static void NAME##_triangle_setup(const struct mcc_rasterization_context *r_context) { \
+        triangle_setup_compute(r_context, (struct raster_variant){ __VA_ARGS__ }); \
+    } \
+    static void NAME##_shade_visibility(const struct mcc_rasterization_context *r_context, uint32_t x, uint32_t y, uint32_t mask) { \
+        shade_visibility(r_context, (struct raster_variant){ __VA_ARGS__ }, x, y, mask); \
+    } \
+    static const struct raster_kernel NAME = { \
+        .rasterize_triangle = NAME##_rasterize_triangle, \
+        .triangle_setup = NAME##_triangle_setup, \
+        .shade_visibility = NAME##_shade_visibility, \
+    };
+
+DEFINE_RASTER_KERNEL(raster_kernel_generic, .depth_test = RASTER_DEPTH_TEST_GENERIC, .varying_count = -1)
+
+#define DEFINE_RASTER_KERNEL_SPECIALIZED(DEPTH_TEST, VARYING_COUNT) \
+    DEFINE_RASTER_KERNEL( \
+        raster_kernel_##DEPTH_TEST##_##VARYING_COUNT, \
+        .depth_test = RASTER_DEPTH_TEST_##DEPTH_TEST, \
+        .color_and_depth = true, \
+        .varying_count = VARYING_COUNT \
+    )
+
+DEFINE_RASTER_KERNEL_SPECIALIZED(LT, 0)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LT, 1)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LT, 2)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LT, 3)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LT, 4)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LTE, 0)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LTE, 1)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LTE, 2)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LTE, 3)
+DEFINE_RASTER_KERNEL_SPECIALIZED(LTE, 4)
+DEFINE_RASTER_KERNEL_SPECIALIZED(EQ, 0)
+DEFINE_RASTER_KERNEL_SPECIALIZED(EQ, 1)
+DEFINE_RASTER_KERNEL_SPECIALIZED(EQ, 2)
+DEFINE_RASTER_KERNEL_SPECIALIZED(EQ, 3)
+DEFINE_RASTER_KERNEL_SPECIALIZED(EQ, 4)
+
+#define DEFINE_RASTER_KERNEL_DEPTH_ONLY(DEPTH_TEST) \
+    DEFINE_RASTER_KERNEL( \
+        raster_kernel_##DEPTH_TEST##_depth_only, \
+        .depth_test = RASTER_DEPTH_TEST_##DEPTH_TEST, \
+        .varying_count = 0, \
+        .depth_only = true \
+    )
+
+DEFINE_RASTER_KERNEL_DEPTH_ONLY(LT)
+DEFINE_RASTER_KERNEL_DEPTH_ONLY(LTE)
+
+static const struct raster_kernel *const raster_kernels_lt[MAX_SPECIALIZED_VARYING_COUNT + 1] = {
+    &raster_kernel_LT_0,
+    &raster_kernel_LT_1,
+    &raster_kernel_LT_2,
+    &raster_kernel_LT_3,
+    &raster_kernel_LT_4,
+};
+static const struct raster_kernel *const raster_kernels_lte[MAX_SPECIALIZED_VARYING_COUNT + 1] = {
+    &raster_kernel_LTE_0,
+    &raster_kernel_LTE_1,
+    &raster_kernel_LTE_2,
+    &raster_kernel_LTE_3,
+    &raster_kernel_LTE_4,
+};
+static const struct raster_kernel *const raster_kernels_eq[MAX_SPECIALIZED_VARYING_COUNT + 1] = {
+    &raster_kernel_EQ_0,
+    &raster_kernel_EQ_1,
+    &raster_kernel_EQ_2,
+    &raster_kernel_EQ_3,
+    &raster_kernel_EQ_4,
+};
+
+/**
+ * Returns the most specialized kernel able to render triangles with the
+ * given state (depth only if there is no fragment shader).
+ */
+static const struct raster_kernel *select_raster_kernel(
+    const struct mcc_cpurast_rendering_attachment *r_attachment,
+    const struct mcc_fragment_shader *o_fragment_shader, uint32_t varying_count,
+    mcc_depth_comparison_fn o_depth_comparison_fn
+) {
+    if (!o_fragment_shader) {
+        if (!r_attachment->o_depth)
+            return &raster_kernel_generic;
+        if (o_depth_comparison_fn == mcc_depth_comparison_fn_lt)
+            return &raster_kernel_LT_depth_only;
+        if (o_depth_comparison_fn == mcc_depth_comparison_fn_lte)
+            return &raster_kernel_LTE_depth_only;
+        return &raster_kernel_generic;
+    }
+
+    if (
+        !r_attachment->o_color ||
+        !r_attachment->o_depth ||
+        varying_count > MAX_SPECIALIZED_VARYING_COUNT
+    )
+        return &raster_kernel_generic;
+
+    if (o_depth_comparison_fn == mcc_depth_comparison_fn_lt)
+        return raster_kernels_lt[varying_count];
+    if (o_depth_comparison_fn == mcc_depth_comparison_fn_lte)
+        return raster_kernels_lte[varying_count];
+    if (o_depth_comparison_fn == mcc_depth_comparison_fn_eq)
+        return raster_kernels_eq[varying_count];
+    return &raster_kernel_generic;
+}
+
+enum clip_outcode_bit {
+    CLIP_OUTCODE_LEFT   = 1u << 0,
+    CLIP_OUTCODE_RIGHT  = 1u << 1,
+    CLIP_OUTCODE_BOTTOM = 1u << 2,
+    CLIP_OUTCODE_TOP    = 1u << 3,
+    CLIP_OUTCODE_NEAR   = 1u << 4,
+    CLIP_OUTCODE_FAR    = 1u << 5,
+    CLIP_OUTCODE_GUARD_LEFT   = 1u << 6,
+    CLIP_OUTCODE_GUARD_RIGHT  = 1u << 7,
+    CLIP_OUTCODE_GUARD_BOTTOM = 1u << 8,
+    CLIP_OUTCODE_GUARD_TOP    = 1u << 9,
+};
+
+#define CLIP_OUTCODE_GUARD_BAND \
+    (CLIP_OUTCODE_GUARD_LEFT | CLIP_OUTCODE_GUARD_RIGHT | CLIP_OUTCODE_GUARD_BOTTOM | CLIP_OUTCODE_GUARD_TOP)
+/**
+ * Sides triangles are clipped against, the others are handled by the
+ * rasterizer.
+ */
+#define CLIP_OUTCODE_CLIPPED (CLIP_OUTCODE_NEAR | CLIP_OUTCODE_FAR | CLIP_OUTCODE_GUARD_BAND)
+
+/**
+ * Half extent, in normalized device coordinates, of the guard band along
+ * each axis. Triangles are only clipped against the left, right, bottom and
+ * top planes of the guard band (and not of the view), so only the rare ones
+ * extending far outside of the view are, the rasterizer skipping the pixels
+ * outside of the view.
+ */
+struct guard_band {
+    float x;
+    float y;
+};
+
+/**
+ * The guard band of a viewport, the biggest one whose clipped triangles
+ * still fit (with a margin) in the fixed point coordinates of the
+ * rasterizer.
+ */
+static struct guard_band guard_band_setup(const struct viewport *r_viewport) {
+    // The offset of the viewport must leave room for the guard band
+    assert(
+        (fabsf(r_viewport->x) + r_viewport->width) * (float)SUBPIXEL_ONE < 0.25f * MAX_FIXED_POINT_COORDINATE &&
+        (fabsf(r_viewport->y) + r_viewport->height) * (float)SUBPIXEL_ONE < 0.25f * MAX_FIXED_POINT_COORDINATE
+    );
+    struct guard_band guard_band = {
+        .x = 0.5f * MAX_FIXED_POINT_COORDINATE / (0.5f * r_viewport->width * (float)SUBPIXEL_ONE),
+        .y = 0.5f * MAX_FIXED_POINT_COORDINATE / (0.5f * r_viewport->height * (float)SUBPIXEL_ONE),
+    };
+    assert(guard_band.x > 1.f && guard_band.y > 1.f);
+    return guard_band;
+}
+
+/**
+ * Bitmask of the sides of the clip volume and of the guard band (see
+ * `enum clip_outcode_bit`) the given clip space position is outside of.
+ */
+static uint32_t clip_outcode(mcc_vec4f pos, struct guard_band guard_band) {
+    return (pos.x < -pos.w ? CLIP_OUTCODE_LEFT : 0u)
+         | (pos.x > +pos.w ? CLIP_OUTCODE_RIGHT : 0u)
+         | (pos.y < -pos.w ? CLIP_OUTCODE_BOTTOM : 0u)
+         | (pos.y > +pos.w ? CLIP_OUTCODE_TOP : 0u)
+         | (pos.z < -pos.w ? CLIP_OUTCODE_NEAR : 0u)
+         | (pos.z > +pos.w ? CLIP_OUTCODE_FAR : 0u)
+         | (pos.x < -guard_band.x * pos.w ? CLIP_OUTCODE_GUARD_LEFT : 0u)
+         | (pos.x > +guard_band.x * pos.w ? CLIP_OUTCODE_GUARD_RIGHT : 0u)
+         | (pos.y < -guard_band.y * pos.w ? CLIP_OUTCODE_GUARD_BOTTOM : 0u)
+         | (pos.y > +guard_band.y * pos.w ? CLIP_OUTCODE_GUARD_TOP : 0u);
+}
+
+/**
+ * Signed distance of the clip space position to the plane of the given side
+ * (one of CLIP_OUTCODE_CLIPPED), positive on the inside.
+ */
+static float clip_plane_distance(enum clip_outcode_bit side, struct guard_band guard_band, mcc_vec4f pos) {
+    switch (side) {
+    case CLIP_OUTCODE_NEAR:
+        return pos.z + pos.w;
+    case CLIP_OUTCODE_FAR:
+        return pos.w - pos.z;
+    case CLIP_OUTCODE_GUARD_LEFT:
+        return pos.x + guard_band.x * pos.w;
+    case CLIP_OUTCODE_GUARD_RIGHT:
+        return guard_band.x * pos.w - pos.x;
+    case CLIP_OUTCODE_GUARD_BOTTOM:
+        return pos.y + guard_band.y * pos.w;
+    case CLIP_OUTCODE_GUARD_TOP:
+        return guard_band.y * pos.w - pos.y;
+    default:
+        assert(false && "not a clipping plane");
+        return 0.f;
+    }
+}
+
+/**
+ * Context for clipping a single triangle against the planes of some of the
+ * sides in CLIP_OUTCODE_CLIPPED.
+ */
+struct mcc_triangle_clip_context {
+    const size_t varying_count;
+    /**
+     * Position followed by the varyings of each vertex of the triangle.
+     */
+    const mcc_vec4f *r_vertices[3];
+    /**
+     * Sides to clip against.
+     */
+    uint32_t clip_outcodes;
+    struct guard_band guard_band;
+    /**
+     * Memory for the vertices created by the clipping, enough for
+     * MAX_CLIP_VERTICES vertices.
+     */
+    mcc_vec4f *r_scratch;
+    /**
+     * Where the clipped triangles are written, assumes to have enough memory
+     * for MAX_SUBTRIANGLES triangles.
+     */
+    mcc_vec4f *r_out_primitive_buffer;
+    /**
+     * Number of vertices outputed.
+     */
+    size_t out_vertex_count;
+};
+
+/**
+ * Writes in `r_out` the intersection of the edge from the vertex outside of
+ * the plane to the one inside of it.
+ */
+static void clip_edge(
+    const mcc_vec4f *r_outside, const mcc_vec4f *r_inside,
+    float outside_distance, float inside_distance,
+    size_t varying_count, mcc_vec4f *r_out
+) {
+    const float t = outside_distance / (outside_distance - inside_distance);
+
+    for (size_t i = 0; i < varying_count + 1; i++) {
+        r_out[i] = mcc_vec4f_add(
+            mcc_vec4f_scale(r_outside[i], 1.f - t),
+            mcc_vec4f_scale(r_inside[i], t)
+        );
+    }
+}
+
+/**
+ * Sutherland-Hodgman clipping of the triangle as a polygon (the vertices
+ * being kept by reference), one plane after the other, the polygon being
+ * split in a fan of triangles at the end.
+ *
+ * Adapted from
+ * https://www.gabrielgambetta.com/computer-graphics-from-scratch/11-clipping.html
+ * And
+ * https://lisyarus.github.io/blog/posts/implementing-a-tiny-cpu-rasterizer-part-5.html
+ */
+static void clip_triangle(struct mcc_triangle_clip_context *ctx) {
+    const size_t vsib = ctx->varying_count + 1;
+    // Each plane adds at most one vertex to the polygon
+    const mcc_vec4f *polygons[2][3 + NUMBER_OF_CLIPPING_PLANES];
+    const mcc_vec4f **polygon = polygons[0],
+                    **clipped = polygons[1];
+    size_t vertex_count = 3;
+    size_t created_vertex_count = 0;
+    for (size_t i = 0; i < 3; i++)
+        polygon[i] = ctx->r_vertices[i];
+
+    for (uint32_t sides = ctx->clip_outcodes; sides && vertex_count > 0; sides &= sides - 1) {
+        const enum clip_outcode_bit side = 1u << stdc_trailing_zeros(sides);
+
+        float distances[3 + NUMBER_OF_CLIPPING_PLANES];
+        bool all_inside = true;
+        for (size_t i = 0; i < vertex_count; i++) {
+            distances[i] = clip_plane_distance(side, ctx->guard_band, polygon[i][0]);
+            all_inside &= distances[i] > 0.f;
+        }
+        if (all_inside)
+            continue;
+
+        size_t clipped_count = 0;
+        for (size_t i = 0; i < vertex_count; i++) {
+            const size_t next = i + 1 < vertex_count ? i + 1 : 0;
+            const bool inside = distances[i] > 0.f,
+                       next_inside = distances[next] > 0.f;
+            if (inside)
+                clipped[clipped_count++] = polygon[i];
+            if (inside == next_inside)
+                continue;
+
+            assert(created_vertex_count < MAX_CLIP_VERTICES);
+            mcc_vec4f *r_created = &ctx->r_scratch[created_vertex_count++ * vsib];
+            if (inside)
+                clip_edge(polygon[next], polygon[i], distances[next], distances[i], ctx->varying_count, r_created);
+            else
+                clip_edge(polygon[i], polygon[next], distances[i], distances[next], ctx->varying_count, r_created);
+            clipped[clipped_count++] = r_created;
+        }
+
+        const mcc_vec4f **previous = polygon;
+        polygon = clipped;
+        clipped = previous;
+        vertex_count = clipped_count;
+    }
+
+    ctx->out_vertex_count = 0;
+    for (size_t i = 2; i < vertex_count; i++) {
+        const mcc_vec4f *triangle[3] = { polygon[0], polygon[i - 1], polygon[i] };
+        for (size_t vertex_i = 0; vertex_i < 3; vertex_i++) {
+            memcpy(
+                &ctx->r_out_primitive_buffer[ctx->out_vertex_count++ * vsib],
+                triangle[vertex_i],
+                sizeof(mcc_vec4f) * vsib
+            );
+        }
+    }
+}
+
+/**
+ * Returns true if the triangle is known to not produce any fragment, either
+ * because it is fully outside one of the sides of the clip volume, or
+ * because it is back facing (according to `culling_mode`).
+ * Done before clipping so that culled triangles never reach the primitive
+ * buffer nor the binning.
+ *
+ * The winding can only be known here if all vertices are in front of the
+ * camera, otherwise the triangle is kept and the rasterizer culls what
+ * remains of it after clipping.
+ */
+static bool cull_triangle(
+    enum mcc_cpurast_culling_mode culling_mode,
+    mcc_vec4f p0, mcc_vec4f p1, mcc_vec4f p2,
+    const uint32_t outcodes[3]
+) {
+    if (outcodes[0] & outcodes[1] & outcodes[2])
+        return true;
+
+    if (culling_mode == MCC_CPURAST_CULLING_MODE_NONE)
+        return false;
+    if (!(p0.w > 0.f && p1.w > 0.f && p2.w > 0.f))
+        return false;
+
+    mcc_vec2f v0 = mcc_vec2f_scale(p0.xy, 1.f / p0.w),
+              v1 = mcc_vec2f_scale(p1.xy, 1.f / p1.w),
+              v2 = mcc_vec2f_scale(p2.xy, 1.f / p2.w);
+    // Same edge function as in `rasterize_triangle`, but with y pointing up,
+    // so positive for the triangles the rasterizer considers counter
+    // clockwise
+    float area = (v2.x - v0.x) * (v1.y - v0.y)
+               - (v2.y - v0.y) * (v1.x - v0.x);
+    if (area == 0.f)
+        return true;
+
+    bool isCcw = area > 0.f;
+    return (culling_mode == MCC_CPURAST_CULLING_MODE_CW && isCcw) ||
+           (culling_mode == MCC_CPURAST_CULLING_MODE_CCW && !isCcw);
+}
+
+/**
+ * Number of varyings kept with the vertices of the primitive buffer, the
+ * varyings of depth only draws being dropped after the vertex shader.
+ */
+static uint32_t draw_varying_count(const struct mcc_vertex_shader *r_vertex_shader, const struct mcc_fragment_shader *o_fragment_shader) {
+    return o_fragment_shader ? r_vertex_shader->varying_count : 0;
+}
+
+/**
+ * Asserts that the draw is valid.
+ */
+static void validate_draw(const struct mcc_cpurast_render_config *r_config) {
+    if (r_config->o_fragment_shader)
+        assert(r_config->o_fragment_shader->varying_count == r_config->r_vertex_shader->varying_count);
+    else
+        assert(!r_config->r_attachment->o_color);
+    assert(r_config->shading_mode != MCC_CPURAST_SHADING_MODE_DEPTH_PREPASS || r_config->r_attachment->o_depth);
+}
+
+struct vertex_process_task_data {
+    void *o_fragment_shader_data;
+    struct mcc_fragment_shader *o_fragment_shader;
+    void *o_vertex_shader_data;
+    struct mcc_vertex_shader *r_vertex_shader;
+
+    enum mcc_cpurast_culling_mode culling_mode;
+    enum mcc_cpurast_vertex_processing vertex_processing;
+
+    uint32_t vertex_start_idx;
+    uint32_t vertex_count;
+    /**
+     * Index buffer of the render config, if not NULL `vertex_start_idx` and
+     * `vertex_count` are a range of indices.
+     */
+    const uint32_t *o_indices;
+    /**
+     * Index of the task's draw in the submission, not used by the task.
+     */
+    uint32_t draw_idx;
+
+    /**
+     * To be decremented when the task is finished (if != NULL)
+     */
+    struct mcc_wait_counter *o_wait_counter;
+
+    /**
+     * Memory for the temporary arrays of the task,
+     * see `vertex_task_scratch_layout`.
+     */
+    void *r_scratch;
+
+    /**
+     * Buffer where to store all proccessed and clipped triangles
+     * must be of at least `vertex_count * MAX_SUBTRIANGLES * (varying_count + 1)` size
+     */
+    mcc_vec4f *r_out_primitive_buffer;
+    uint32_t out_vertex_count;
+    /**
+     * Only the vertex and triangle counters are set.
+     */
+    struct mcc_cpurast_pipeline_statistics out_statistics;
+
+    /**
+     * Viewport and scissor of the draw, used to compute the tiles covered
+     * by each triangle.
+     */
+    struct viewport viewport;
+    /**
+     * One element for each triangle written in `r_out_primitive_buffer`,
+     * set to the (exclusive) range of tiles the triangle may cover.
+     */
+    struct pixel_rect *r_out_tile_bounds;
+};
+
+/**
+ * Range of tiles covered by the given triangle (made of the first three
+ * vertices of the buffer, each followed by its varyings).
+ */
+static struct pixel_rect triangle_tile_bounds(const mcc_vec4f *r_vertices, size_t varying_count, const struct viewport *r_viewport) {
+    const size_t vsib = varying_count + 1;
+    mcc_vec2f p0 = mcc_vec2f_scale(r_vertices[vsib * 0].xy, 1.f / r_vertices[vsib * 0].w),
+              p1 = mcc_vec2f_scale(r_vertices[vsib * 1].xy, 1.f / r_vertices[vsib * 1].w),
+              p2 = mcc_vec2f_scale(r_vertices[vsib * 2].xy, 1.f / r_vertices[vsib * 2].w);
+
+    struct fixed_point_triangle tri;
+    if (!fixed_point_triangle_setup(p0, p1, p2, r_viewport, &tri))
+        return (struct pixel_rect){};
+
+    struct pixel_rect bounds = fixed_point_triangle_bounds(&tri, r_viewport);
+    return (struct pixel_rect){
+        .min_x = bounds.min_x / TILE_SIZE,
+        .min_y = bounds.min_y / TILE_SIZE,
+        .max_x = mcc_up_div(bounds.max_x, TILE_SIZE),
+        .max_y = mcc_up_div(bounds.max_y, TILE_SIZE),
+    };
+}
+
+/**
+ * Temporary arrays of a vertex processing task.
+ */
+struct vertex_task_scratch {
+    /**
+     * Slot of each vertex of the task.
+     */
+    uint32_t *vertex_slots;
+    /**
+     * Vertex index of each slot.
+     */
+    uint32_t *slot_vertices;
+    /**
+     * Hash table from vertex indices to slots, of `slot_cache_size` elements.
+     */
+    uint32_t *slot_cache;
+    uint32_t slot_cache_size;
+    /**
+     * Position followed by varyings of each slot.
+     */
+    mcc_vec4f *shaded_vertices;
+    /**
+     * Clip outcode (see `clip_outcode`) of each slot.
+     */
+    uint32_t *slot_outcodes;
+    float (*batch_varyings)[4][MCC_CPURAST_VERTEX_BATCH_SIZE];
+    /**
+     * Vertices created by the clipping of a triangle, see
+     * `struct mcc_triangle_clip_context`.
+     */
+    mcc_vec4f *clip_vertices;
+};
+
+/**
+ * Splits the scratch memory of a task of (at most) `vertex_count` vertices,
+ * `varying_count` being the number of varyings kept for the draw and
+ * `shader_varying_count` the number of varyings written by the vertex
+ * shader (which may be more).
+ */
+static struct vertex_task_scratch vertex_task_scratch_layout(
+    struct scratch_allocator *r_alloc,
+    uint32_t varying_count, uint32_t shader_varying_count, uint32_t vertex_count
+) {
+    struct vertex_task_scratch scratch;
+    // Kept at most half full
+    scratch.slot_cache_size = (uint32_t)mcc_next_pow_of_2(2 * vertex_count);
+    scratch.vertex_slots = scratch_alloc(r_alloc, sizeof(*scratch.vertex_slots) * vertex_count);
+    scratch.slot_vertices = scratch_alloc(r_alloc, sizeof(*scratch.slot_vertices) * vertex_count);
+    scratch.slot_cache = scratch_alloc(r_alloc, sizeof(*scratch.slot_cache) * scratch.slot_cache_size);
+    scratch.shaded_vertices = scratch_alloc(r_alloc, sizeof(*scratch.shaded_vertices) * (varying_count + 1) * vertex_count);
+    scratch.slot_outcodes = scratch_alloc(r_alloc, sizeof(*scratch.slot_outcodes) * vertex_count);
+    scratch.batch_varyings = scratch_alloc(r_alloc, sizeof(*scratch.batch_varyings) * shader_varying_count);
+    scratch.clip_vertices = scratch_alloc(r_alloc, sizeof(*scratch.clip_vertices) * (varying_count + 1) * MAX_CLIP_VERTICES);
+    return scratch;
+}
+
+/**
+ * Post-transform vertex cache: gives to each vertex of the task a slot in
+ * the buffer of shaded vertices, vertices referenced multiple times (through
+ * the index buffer) sharing the same slot so they are only shaded once.
+ * Fills `vertex_slots` with the slot of each of the task's vertices and
+ * `slot_vertices` with the vertex index of each slot, returns the number of
+ * slots.
+ */
+static uint32_t assign_vertex_slots(const struct vertex_process_task_data *r_data, const struct vertex_task_scratch *r_scratch) {
+    uint32_t *r_out_slots = r_scratch->vertex_slots;
+    uint32_t *r_out_vertices = r_scratch->slot_vertices;
+
+    if (!r_data->o_indices) {
+        for (uint32_t vertex_i = 0; vertex_i < r_data->vertex_count; vertex_i++) {
+            r_out_slots[vertex_i] = vertex_i;
+            r_out_vertices[vertex_i] = r_data->vertex_start_idx + vertex_i;
+        }
+        return r_data->vertex_count;
+    }
+
+    const uint32_t *indices = &r_data->o_indices[r_data->vertex_start_idx];
+
+    // Open addressing hash table from vertex indices to slots
+    const uint32_t cache_size = r_scratch->slot_cache_size;
+    uint32_t *cache = r_scratch->slot_cache;
+    memset(cache, 0xff, sizeof(*cache) * cache_size);
+    const uint32_t empty_entry = UINT32_MAX;
+
+    uint32_t slot_count = 0;
+    for (uint32_t vertex_i = 0; vertex_i < r_data->vertex_count; vertex_i++) {
+        const uint32_t vertex_idx = indices[vertex_i];
+
+        uint32_t entry = (vertex_idx * 2654435761u) & (cache_size - 1);
+        while (cache[entry] != empty_entry && r_out_vertices[cache[entry]] != vertex_idx)
+            entry = (entry + 1) & (cache_size - 1);
+
+        if (cache[entry] == empty_entry) {
+            cache[entry] = slot_count;
+            r_out_vertices[slot_count++] = vertex_idx;
+        }
+        r_out_slots[vertex_i] = cache[entry];
+    }
+
+    return slot_count;
+}
+
+/**
+ * Runs the vertex shader on the given vertices, writing each vertex's
+ * position followed by its varyings to `shaded_vertices`.
+ */
+static void shade_vertices(
+    const struct vertex_process_task_data *r_data,
+    const uint32_t *r_vertices, uint32_t vertex_count,
+    const struct vertex_task_scratch *r_scratch
+) {
+    mcc_vec4f *r_out_vertices = r_scratch->shaded_vertices;
+    const struct mcc_vertex_shader *r_vertex_shader = r_data->r_vertex_shader;
+    // Varyings kept, the others are written to `batch_varyings` and ignored
+    const uint32_t varying_count = draw_varying_count(r_vertex_shader, r_data->o_fragment_shader);
+    // Number of elements in the vertex buffer for a single vertex
+    const uint32_t vsib = varying_count + 1;
+
+    // Depth only draws only need the positions
+    const bool position_only = varying_count == 0 && r_vertex_shader->o_position_batch_fn;
+    const mcc_vertex_shader_batch_fn o_batch_fn = position_only
+        ? r_vertex_shader->o_position_batch_fn
+        : r_vertex_shader->o_batch_fn;
+
+    if (o_batch_fn) {
+        struct mcc_cpurast_vertex_batch_input batch_input = {
+            .o_in_data = r_data->o_vertex_shader_data,
+            .r_out_varyings = position_only ? NULL : r_scratch->batch_varyings,
+        };
+
+        for (uint32_t batch_start = 0; batch_start < vertex_count; batch_start += MCC_CPURAST_VERTEX_BATCH_SIZE) {
+            batch_input.in_vertex_count = mcc_min(MCC_CPURAST_VERTEX_BATCH_SIZE, vertex_count - batch_start);
+            for (uint32_t lane = 0; lane < batch_input.in_vertex_count; lane++)
+                batch_input.in_vertex_indices[lane] = r_vertices[batch_start + lane];
+            o_batch_fn(&batch_input);
+
+            // Back to one vertex after the other for primitive assembly
+            for (uint32_t lane = 0; lane < batch_input.in_vertex_count; lane++) {
+                mcc_vec4f *vertex = &r_out_vertices[(batch_start + lane) * vsib];
+                vertex[0] = (mcc_vec4f){{
+                    batch_input.out_position[0][lane],
+                    batch_input.out_position[1][lane],
+                    batch_input.out_position[2][lane],
+                    batch_input.out_position[3][lane],
+                }};
+                for (uint32_t varying_i = 0; varying_i < varying_count; varying_i++) {
+                    vertex[1 + varying_i] = (mcc_vec4f){{
+                        batch_input.r_out_varyings[varying_i][0][lane],
+                        batch_input.r_out_varyings[varying_i][1][lane],
+                        batch_input.r_out_varyings[varying_i][2][lane],
+                        batch_input.r_out_varyings[varying_i][3][lane],
+                    }};
+                }
+            }
+        }
 
-            const float fx = (float)x + 0.5f,
-                        fy = (float)y + 0.5f;
+        return;
+    }
+
+    struct mcc_cpurast_vertex_shader_input vert_input = {
+        .o_in_data = r_data->o_vertex_shader_data,
+    };
+    for (uint32_t vertex_i = 0; vertex_i < vertex_count; vertex_i++) {
+        mcc_vec4f *vertex = &r_out_vertices[vertex_i * vsib];
+        vert_input.in_vertex_idx = r_vertices[vertex_i];
+        vert_input.r_out_varyings = varying_count == r_vertex_shader->varying_count
+            ? (union mcc_cpurast_shaders_varying*)&vertex[1]
+            : (union mcc_cpurast_shaders_varying*)r_scratch->batch_varyings;
+        r_vertex_shader->r_fn(&vert_input);
+        vertex[0] = vert_input.out_position;
+    }
+}
+
+static void vertex_process_task(void *r_void_data) {
+    struct vertex_process_task_data *r_data = r_void_data;
+    assert(r_data != NULL);
+
+    uint32_t varying_count = draw_varying_count(r_data->r_vertex_shader, r_data->o_fragment_shader);
+
+    // Number of elements in the primitive buffer for a single vertex
+    const uint32_t vsib = varying_count + 1;
 
-            // Normalized screen coordinates
-            const mcc_vec2f screen_pos = {{
-                fx * 2.f / wf - 1.f,
-                fy *-2.f / hf + 1.f,
-            }};
+    // Every vertex referenced by the task is shaded exactly once, before
+    // assembling the primitives
+    struct scratch_allocator scratch_alloc = { .o_base = r_data->r_scratch };
+    const struct vertex_task_scratch scratch = vertex_task_scratch_layout(
+        &scratch_alloc, varying_count, r_data->r_vertex_shader->varying_count, r_data->vertex_count
+    );
+    const uint32_t *vertex_slots = scratch.vertex_slots;
+    const mcc_vec4f *shaded_vertices = scratch.shaded_vertices;
 
-            // Calculate barycentric coordinates
-            const float det01p = mcc_mat2f_det(mcc_mat2f_col(p1p0, mcc_vec2f_sub(screen_pos, p0)));
-            const float det12p = mcc_mat2f_det(mcc_mat2f_col(p2p1, mcc_vec2f_sub(screen_pos, p1)));
-            const float det20p = mcc_mat2f_det(mcc_mat2f_col(p0p2, mcc_vec2f_sub(screen_pos, p2)));
+    const uint32_t slot_count = assign_vertex_slots(r_data, &scratch);
+    shade_vertices(r_data, scratch.slot_vertices, slot_count, &scratch);
 
-            const bool isInside = det01p >= 0.f && det12p >= 0.f && det20p >= 0.f;
-            if (!isInside)
-                continue;
-            const struct mcc_barycentric_coords barycentric = {
-                .u = det20p / det012,
-                .v = det01p / det012,
-                .w = det12p / det012,
-            };
+    const struct guard_band guard_band = guard_band_setup(&r_data->viewport);
+    for (uint32_t slot_i = 0; slot_i < slot_count; slot_i++)
+        scratch.slot_outcodes[slot_i] = clip_outcode(shaded_vertices[slot_i * vsib], guard_band);
 
-            // Calculate depth using barycentric coordinates
-            float depth = v1.z * barycentric.u + v2.z * barycentric.v + v0.z * barycentric.w;
+    struct mcc_cpurast_pipeline_statistics statistics = {
+        .vertex_shader_invocations = slot_count,
+    };
 
-            // Depth comparison function test
-            if (
-                depth_attachment &&
-                r_context->o_depth_comparison_fn &&
-                !r_context->o_depth_comparison_fn(depth_attachment->r_data[pixel_idx], depth)
-            ) {
-                continue;
-            }
+    // Index (relative to the task's first vertex) of the last vertex of the
+    // first primitive, and the increment to go to the next primitive
+    uint32_t vertex_i;
+    uint32_t vertex_index_increment;
+    switch (r_data->vertex_processing) {
+    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_LIST:
+        vertex_i = 2;
+        vertex_index_increment = 3;
+        break;
+    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_STRIP:
+        // The second and third vertices of every primitive are the first two
+        // vertices of the next one
+        vertex_i = 2;
+        vertex_index_increment = 1;
+        break;
+    }
+    uint32_t output_vertex_counter = 0;
 
-            // Process this fragment
-            struct mcc_pixel_params pixel = {
-                .barycentric = barycentric,
-                .screen_pos = screen_pos,
-                .depth = depth,
-                .pixel_idx = pixel_idx
-            };
-            process_fragment(r_context, &pixel);
+    for (; vertex_i < r_data->vertex_count; vertex_i += vertex_index_increment) {
+        const uint32_t slots[3] = { vertex_slots[vertex_i - 2], vertex_slots[vertex_i - 1], vertex_slots[vertex_i - 0] };
+        const mcc_vec4f *r_vertices[3] = {
+            &shaded_vertices[slots[0] * vsib],
+            &shaded_vertices[slots[1] * vsib],
+            &shaded_vertices[slots[2] * vsib],
+        };
+        const uint32_t outcodes[3] = { scratch.slot_outcodes[slots[0]], scratch.slot_outcodes[slots[1]], scratch.slot_outcodes[slots[2]] };
+        statistics.input_triangles++;
+        if (cull_triangle(r_data->culling_mode, *r_vertices[0], *r_vertices[1], *r_vertices[2], outcodes)) {
+            statistics.culled_triangles++;
+            continue;
         }
-    }
-}
 
-static void clip_triangle(struct mcc_triangle_clip_context *ctx) {
-    const size_t tri_buff_size = (ctx->varying_count + 1) * 3;
-    const size_t tri_byte_size = tri_buff_size * sizeof(mcc_vec4f);
-
-    size_t triangle_count = 1;
-
-    for (size_t plane_i = 0; plane_i < sizeof(clipping_planes) / sizeof(*clipping_planes); plane_i++) {
-        // We process the whole primitive buffer each time, but we also
-        // modify it inline, modifying the current primitive, as well as adding
-        // new ones at the end.
-        // Removing the current primitive is done by shifting the whole buffer
-        // one to the left (cannot do a swap remove by copying the last one
-        // because if new ones were added before the last one may not be one we
-        // should clip right now)
-        
-        size_t previous_triangle_count = triangle_count;
-        for (size_t triangle_i = 0; triangle_i < previous_triangle_count;) {
-            struct plane_clip_triangle_context sctx = {
-                .varying_count = ctx->varying_count,
-                .r_primitive_buffer = ctx->r_primitive_buffer + triangle_i * tri_buff_size,
-                .primitive_buffer_count = triangle_count,
-                .in_out_triangle_count = 1,
-                .plane = clipping_planes[plane_i],
+        mcc_vec4f *r_out_vertices = &r_data->r_out_primitive_buffer[output_vertex_counter * vsib];
+        uint32_t out_vertex_count = 3;
+        uint32_t clip_outcodes = (outcodes[0] | outcodes[1] | outcodes[2]) & CLIP_OUTCODE_CLIPPED;
+        if (!clip_outcodes) {
+            // Trivially accepted, the x and y sides of the view being handled
+            // by the rasterizer
+            for (uint32_t di = 0; di < 3; di++)
+                memcpy(&r_out_vertices[di * vsib], r_vertices[di], sizeof(mcc_vec4f) * vsib);
+        } else {
+            statistics.clipped_triangles++;
+            // The vertices created on the near and far planes can be outside
+            // of the guard band even if none of the triangle's are
+            if (clip_outcodes & (CLIP_OUTCODE_NEAR | CLIP_OUTCODE_FAR))
+                clip_outcodes |= CLIP_OUTCODE_GUARD_BAND;
+            struct mcc_triangle_clip_context clip_ctx = {
+                .varying_count = varying_count,
+                .r_vertices = { r_vertices[0], r_vertices[1], r_vertices[2] },
+                .clip_outcodes = clip_outcodes,
+                .guard_band = guard_band,
+                .r_scratch = scratch.clip_vertices,
+                .r_out_primitive_buffer = r_out_vertices,
             };
-            clip_triangle_once(&sctx);
-
-            switch (sctx.in_out_triangle_count) {
-            case 0:
-                // Shifts the whole buffer one primitive to the left
-                
-                if (triangle_count > triangle_i + 1) {
-                    memmove(
-                        &sctx.r_primitive_buffer[tri_buff_size * triangle_i],
-                        &sctx.r_primitive_buffer[tri_buff_size * (triangle_i + 1)],
-                        tri_byte_size * (triangle_count - triangle_i - 1)
-                    );
-                }
+            clip_triangle(&clip_ctx);
+            out_vertex_count = (uint32_t)clip_ctx.out_vertex_count;
+        }
 
-                // One less primitive now
-                assert(triangle_count > 0);
-                triangle_count -= 1;
-                
-                // We do not increment primitive_i, the buffer moved, not the
-                // index
-                previous_triangle_count--;
-                break;
-            case 1:
-                // Noting special to do here (the primitive was just edited inline)
-                triangle_i++;
-                break;
-            case 2:
-                // One primitive was added to the end, only difference.
-                triangle_count += 1;
-                triangle_i++;
-                break;
-            }
+        for (uint32_t sub_vertex_i = 0; sub_vertex_i < out_vertex_count; sub_vertex_i += 3) {
+            r_data->r_out_tile_bounds[(output_vertex_counter + sub_vertex_i) / 3] = triangle_tile_bounds(
+                &r_data->r_out_primitive_buffer[(output_vertex_counter + sub_vertex_i) * vsib],
+                varying_count,
+                &r_data->viewport
+            );
         }
+
+        output_vertex_counter += out_vertex_count;
     }
 
-    ctx->out_vertex_count = triangle_count * 3;
+    statistics.rasterized_triangles = output_vertex_counter / 3;
+    r_data->out_vertex_count = output_vertex_counter;
+    r_data->out_statistics = statistics;
+
+    if (r_data->o_wait_counter)
+        mcc_wait_counter_decrement(r_data->o_wait_counter, 1);
 }
 
-struct vertex_process_task_data {
-    void *o_fragment_shader_data;
-    struct mcc_fragment_shader *r_fragment_shader;
-    void *o_vertex_shader_data;
-    struct mcc_vertex_shader *r_vertex_shader;
+/**
+ * Reference to a triangle of a batch's primitive buffer.
+ */
+struct binned_triangle {
+    /**
+     * Index of the triangle's draw in the submission.
+     */
+    uint32_t draw_idx;
+    /**
+     * Index (in the primitive buffer, in `mcc_vec4f`) of the position of the
+     * triangle's first vertex.
+     */
+    uint32_t offset;
+};
 
-    enum mcc_cpurast_culling_mode culling_mode;
-    enum mcc_cpurast_vertex_processing vertex_processing;
+/**
+ * What the triangles of a tile are rasterized for.
+ */
+enum tile_pass {
+    /**
+     * Fragments passing the depth test of their draw are shaded, or written
+     * to the visibility buffer with deferred shading.
+     */
+    TILE_PASS_SHADE,
+    /**
+     * First pass of the depth prepass, all draws are depth only.
+     */
+    TILE_PASS_DEPTH,
+    /**
+     * Second pass of the depth prepass, only the fragments whose depth is
+     * the one left by the first pass are shaded.
+     */
+    TILE_PASS_DEPTH_EQUAL,
+};
 
-    uint32_t vertex_start_idx;
-    uint32_t vertex_count;
+struct tile_raster_task_data {
+    /**
+     * The draws of the submission, which all have the same attachment.
+     */
+    const struct mcc_cpurast_render_config *r_draws;
+    /**
+     * Maximum varying count of the draws, used for the size of the scratch
+     * arrays.
+     */
+    uint32_t max_varying_count;
+    enum mcc_cpurast_shading_mode shading_mode;
+    /**
+     * The passes run on the triangles of the tile, in order.
+     */
+    enum tile_pass first_pass;
+    enum tile_pass last_pass;
+
+    /**
+     * Buffer filled by the vertex processing tasks
+     */
+    const mcc_vec4f *r_primitive_buffer;
+    /**
+     * Triangles to rasterize in this tile, in submission order.
+     */
+    const struct binned_triangle *r_triangles;
+    uint32_t triangle_count;
+
+    struct pixel_rect tile_rect;
+
+    /**
+     * Memory for the temporary arrays of the task,
+     * see `tile_task_scratch_layout`.
+     */
+    void *r_scratch;
+
+    /**
+     * If not NULL, where to count the fragments of each draw, with room for
+     * one element for each triangle of the tile. Elements are in the order
+     * of their `first_triangle`.
+     */
+    struct draw_fragment_statistics *o_statistics;
+    uint32_t out_statistics_count;
 
     /**
      * To be decremented when the task is finished (if != NULL)
      */
     struct mcc_wait_counter *o_wait_counter;
+};
 
+/**
+ * Temporary arrays of a tile rasterization task.
+ */
+struct tile_task_scratch {
+    union mcc_cpurast_shaders_varying *primitive_varyings[3];
+    union mcc_cpurast_shaders_varying *fragment_varyings;
+    float (*packet_varyings)[4][MCC_CPURAST_FRAGMENT_PACKET_SIZE];
+    struct varying_plane *varying_planes;
     /**
-     * Buffer where to store all proccessed and clipped triangles
-     * must be of at least `vertex_count * MAX_SUBTRIANGLES * (varying_count + 1)` size
+     * Only with deferred shading.
      */
-    mcc_vec4f *r_out_primitive_buffer;
-    uint32_t out_vertex_count;
+    struct tile_visibility visibility;
 };
 
-static void vertex_process_task(void *r_void_data) {
-    struct vertex_process_task_data *r_data = r_void_data;
-    assert(r_data != NULL);
+static struct tile_task_scratch tile_task_scratch_layout(struct scratch_allocator *r_alloc, uint32_t varying_count, bool deferred_shading) {
+    struct tile_task_scratch scratch = {};
+    for (size_t i = 0; i < 3; i++)
+        scratch.primitive_varyings[i] = scratch_alloc(r_alloc, sizeof(*scratch.primitive_varyings[i]) * varying_count);
+    scratch.fragment_varyings = scratch_alloc(r_alloc, sizeof(*scratch.fragment_varyings) * varying_count);
+    scratch.packet_varyings = scratch_alloc(r_alloc, sizeof(*scratch.packet_varyings) * varying_count);
+    scratch.varying_planes = scratch_alloc(r_alloc, sizeof(*scratch.varying_planes) * varying_count);
+    if (deferred_shading) {
+        const size_t tile_pixel_count = TILE_SIZE * TILE_SIZE;
+        scratch.visibility.triangles = scratch_alloc(r_alloc, sizeof(*scratch.visibility.triangles) * tile_pixel_count);
+        scratch.visibility.u = scratch_alloc(r_alloc, sizeof(*scratch.visibility.u) * tile_pixel_count);
+        scratch.visibility.v = scratch_alloc(r_alloc, sizeof(*scratch.visibility.v) * tile_pixel_count);
+        scratch.visibility.depth = scratch_alloc(r_alloc, sizeof(*scratch.visibility.depth) * tile_pixel_count);
+    }
+    return scratch;
+}
 
-    assert(r_data->r_fragment_shader->varying_count == r_data->r_vertex_shader->varying_count);
-    uint32_t varying_count = r_data->r_vertex_shader->varying_count;
+/**
+ * Rasterization state of a tile task.
+ */
+struct tile_raster_state {
+    struct mcc_rasterization_context context;
+    primitive_t primitive;
+    struct mcc_cpurast_fragment_shader_input frag_input;
+    struct mcc_cpurast_fragment_packet_input frag_packet_input;
+    struct triangle_setup setup;
+    /**
+     * Draw and pass whose state is currently in the rasterization context.
+     */
+    uint32_t draw_idx;
+    enum tile_pass pass;
+    const struct raster_kernel *r_kernel;
+    /**
+     * Number of elements of each vertex of the draw in the primitive buffer.
+     */
+    uint32_t vertex_stride;
+};
 
-    // Number of elements in the primitive buffer for a single vertex
-    const uint32_t vsib = varying_count + 1;
+/**
+ * Loads the given triangle of the tile in the rasterization context (and the
+ * state of its draw for the given pass if needed).
+ */
+static void tile_raster_state_load_triangle(
+    const struct tile_raster_task_data *r_data, struct tile_raster_state *r_state,
+    uint32_t triangle_i, enum tile_pass pass
+) {
+    const struct binned_triangle *triangle = &r_data->r_triangles[triangle_i];
+
+    if (triangle->draw_idx != r_state->draw_idx || pass != r_state->pass) {
+        r_state->draw_idx = triangle->draw_idx;
+        r_state->pass = pass;
+        const struct mcc_cpurast_render_config *r_config = &r_data->r_draws[r_state->draw_idx];
+        struct mcc_fragment_shader *o_fragment_shader = pass == TILE_PASS_DEPTH ? NULL : r_config->o_fragment_shader;
+
+        r_state->frag_input.o_in_data = r_config->o_fragment_shader_data;
+        r_state->frag_packet_input.o_in_data = r_config->o_fragment_shader_data;
+        r_state->context.culling_mode = r_config->culling_mode;
+        r_state->context.polygon_mode = r_config->polygon_mode;
+        r_state->context.viewport = viewport_setup(r_config);
+        r_state->context.o_fragment_shader = o_fragment_shader;
+        r_state->context.o_depth_comparison_fn = pass == TILE_PASS_DEPTH_EQUAL
+            ? mcc_depth_comparison_fn_eq
+            : r_config->o_depth_comparison_fn;
+        r_state->context.varying_count = draw_varying_count(r_config->r_vertex_shader, o_fragment_shader);
+        r_state->r_kernel = select_raster_kernel(
+            r_config->r_attachment, o_fragment_shader,
+            (uint32_t)r_state->context.varying_count, r_state->context.o_depth_comparison_fn
+        );
+        r_state->vertex_stride = draw_varying_count(r_config->r_vertex_shader, r_config->o_fragment_shader) + 1;
+    }
 
-    // Contains the vertices of the currently proccesed primitive
-    mcc_vec4f *current_primitive_buffer = calloc(vsib * 3, sizeof(mcc_vec4f));
+    const size_t varying_count = r_state->context.varying_count;
+    const mcc_vec4f *vs = &r_data->r_primitive_buffer[triangle->offset];
+    for (uint32_t sub_vert_i = 0; sub_vert_i < 3; sub_vert_i++, vs += r_state->vertex_stride) {
+        r_state->primitive.vertices[sub_vert_i].pos_homogeneous = vs[0];
+        r_state->primitive.vertices[sub_vert_i].w_inv = 1.f / vs[0].w;
+        for (uint32_t varying_i = 0; varying_i < varying_count; varying_i++) {
+            r_state->primitive.vertices[sub_vert_i].varyings[varying_i].vec4f = vs[1 + varying_i];
+        }
+    }
+    r_state->context.triangle_idx = triangle_i;
+}
 
-    struct mcc_cpurast_vertex_shader_input vert_input = {
-        .o_in_data = r_data->o_vertex_shader_data,
-    };
+/**
+ * Returns the statistics the fragments of the given triangle of the tile are
+ * counted in, `o_statistics` of the task must not be NULL.
+ */
+static struct draw_fragment_statistics *tile_triangle_statistics(const struct tile_raster_task_data *r_data, uint32_t triangle_i) {
+    assert(r_data->o_statistics != NULL && r_data->out_statistics_count > 0);
+
+    // Last element starting at or before the triangle
+    uint32_t lo = 0, hi = r_data->out_statistics_count;
+    while (hi - lo > 1) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (r_data->o_statistics[mid].first_triangle <= triangle_i)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &r_data->o_statistics[lo];
+}
 
-    uint32_t vertex_idx = r_data->vertex_start_idx;
-    uint32_t vertex_index_increment;
-    
-    switch (r_data->vertex_processing) {
-    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_LIST:
-        vertex_index_increment = 3;
-        break;
-    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_STRIP:
-        // If we are in triangle strip, the first two vertices must be processed before
-        // for the next primitives, the first two vertices will be the ones from the
-        // previous primitive.
-        vertex_index_increment = 1;
-        for (size_t di = 0; di < 2; di++, vertex_idx++) {
-            vert_input.in_vertex_idx = vertex_idx;
-            vert_input.r_out_varyings = (union mcc_cpurast_shaders_varying*)
-                &current_primitive_buffer[vsib * di + 1];
-            r_data->r_vertex_shader->r_fn(&vert_input);
-            current_primitive_buffer[vsib * di] = vert_input.out_position;
+/**
+ * Second pass of deferred shading, shades each pixel of the visibility
+ * buffer as `rasterize_triangle` would have.
+ */
+static void tile_shade_visibility(const struct tile_raster_task_data *r_data, struct tile_raster_state *r_state) {
+    const struct pixel_rect tile_rect = r_data->tile_rect;
+    const struct tile_visibility *visibility = r_state->context.o_visibility;
+
+    // Visibility value of the triangle in the primitive
+    uint32_t loaded_triangle = VISIBILITY_NONE;
+
+    for (uint32_t y = tile_rect.min_y; y < tile_rect.max_y; y++) {
+        for (uint32_t block_min_x = tile_rect.min_x; block_min_x < tile_rect.max_x; block_min_x += MCC_SIMD_WIDTH) {
+            const size_t tile_row_idx = (block_min_x - tile_rect.min_x) + (y - tile_rect.min_y) * TILE_SIZE;
+            const uint32_t *row_triangles = &visibility->triangles[tile_row_idx];
+            const uint32_t lane_count = mcc_min(tile_rect.max_x - block_min_x, MCC_SIMD_WIDTH);
+
+            uint32_t remaining = 0;
+            for (uint32_t lane = 0; lane < lane_count; lane++)
+                remaining |= (row_triangles[lane] != VISIBILITY_NONE ? 1u : 0u) << lane;
+
+            // Shade the lanes of each triangle together
+            while (remaining) {
+                const uint32_t triangle = row_triangles[stdc_trailing_zeros(remaining)];
+                uint32_t triangle_mask = 0;
+                for (uint32_t lane = 0; lane < lane_count; lane++)
+                    triangle_mask |= (row_triangles[lane] == triangle ? 1u : 0u) << lane;
+                remaining &= ~triangle_mask;
+
+                if (triangle != loaded_triangle) {
+                    loaded_triangle = triangle;
+                    tile_raster_state_load_triangle(r_data, r_state, triangle & ~VISIBILITY_SWAPPED, TILE_PASS_SHADE);
+                    if (triangle & VISIBILITY_SWAPPED) {
+                        struct processed_vertex tv = r_state->primitive.v1;
+                        r_state->primitive.v1 = r_state->primitive.v2;
+                        r_state->primitive.v2 = tv;
+                    }
+                    r_state->r_kernel->triangle_setup(&r_state->context);
+                    if (r_data->o_statistics)
+                        r_state->context.r_statistics = tile_triangle_statistics(r_data, triangle & ~VISIBILITY_SWAPPED);
+                }
+
+                r_state->r_kernel->shade_visibility(&r_state->context, block_min_x, y, triangle_mask);
+            }
         }
-        break;
     }
-    uint32_t output_vertex_counter = 0;
+}
 
-    for (; vertex_idx < r_data->vertex_start_idx + r_data->vertex_count; vertex_idx += vertex_index_increment) {
-        switch (r_data->vertex_processing) {
-        case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_LIST:
-            for (uint32_t di = 0; di < 3; di++) {
-                vert_input.in_vertex_idx = vertex_idx + di;
-                vert_input.r_out_varyings = (union mcc_cpurast_shaders_varying*)
-                    &current_primitive_buffer[vsib * di + 1];
-                r_data->r_vertex_shader->r_fn(&vert_input);
-                current_primitive_buffer[vsib * di] = vert_input.out_position;
+/**
+ * Rasterizes the triangles of the tile one after the other for the given
+ * pass, the statistics elements of the task being started by the task's
+ * first pass.
+ */
+static void tile_rasterize_triangles(struct tile_raster_task_data *r_data, struct tile_raster_state *r_state, enum tile_pass pass) {
+    // Where the fragments are counted, the ignored statistics of the context
+    // if the statistics are not requested
+    struct draw_fragment_statistics *statistics = r_state->context.r_statistics;
+    uint32_t statistics_count = 0;
+    const bool first_pass = pass == r_data->first_pass;
+
+    for (uint32_t triangle_i = 0; triangle_i < r_data->triangle_count; triangle_i++) {
+        const uint32_t draw_idx = r_data->r_triangles[triangle_i].draw_idx;
+        if (r_data->o_statistics && (triangle_i == 0 || r_data->r_triangles[triangle_i - 1].draw_idx != draw_idx)) {
+            statistics = &r_data->o_statistics[statistics_count++];
+            if (first_pass) {
+                *statistics = (struct draw_fragment_statistics){
+                    .draw_idx = draw_idx,
+                    .first_triangle = triangle_i,
+                };
             }
-            break;
-        case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_STRIP:
-            // 'move' the last two vertices on the first one
-            memmove(
-                &current_primitive_buffer[0],
-                &current_primitive_buffer[vsib],
-                // The last two vertex
-                sizeof(mcc_vec4f) * vsib * 2
-            );
+        }
 
-            // Compute the last vertex only
-            vert_input.in_vertex_idx = vertex_idx;
-            vert_input.r_out_varyings = (union mcc_cpurast_shaders_varying*)
-                &current_primitive_buffer[vsib * 2 + 1];
-            r_data->r_vertex_shader->r_fn(&vert_input);
-            current_primitive_buffer[vsib * 2] = vert_input.out_position;
-            break;
+        if (pass != TILE_PASS_DEPTH_EQUAL) {
+            tile_raster_state_load_triangle(r_data, r_state, triangle_i, pass);
+            r_state->context.r_statistics = statistics;
+            r_state->r_kernel->rasterize_triangle(&r_state->context);
+            continue;
         }
 
-        memcpy(
-            &r_data->r_out_primitive_buffer[output_vertex_counter * vsib],
-            current_primitive_buffer,
-            sizeof(mcc_vec4f) * vsib * 3
-        );
-        
-        struct mcc_triangle_clip_context clip_ctx = {
-            .varying_count = varying_count,
-            .r_primitive_buffer = &r_data->r_out_primitive_buffer[output_vertex_counter * vsib],
-        };
-        clip_triangle(&clip_ctx);
+        // Depth only draws are done after the first pass
+        if (!r_data->r_draws[draw_idx].o_fragment_shader)
+            continue;
+        // The fragments were already depth tested by the first pass, only
+        // their shading is counted
+        struct draw_fragment_statistics equal_statistics = {};
+        tile_raster_state_load_triangle(r_data, r_state, triangle_i, pass);
+        r_state->context.r_statistics = &equal_statistics;
+        r_state->r_kernel->rasterize_triangle(&r_state->context);
+        statistics->fragment_shader_invocations += equal_statistics.fragment_shader_invocations;
+    }
+
+    r_state->context.r_statistics = statistics;
+    if (first_pass)
+        r_data->out_statistics_count = statistics_count;
+}
+
+static void tile_raster_task(void *r_void_data) {
+    struct tile_raster_task_data *r_data = r_void_data;
+    assert(r_data != NULL);
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_data->r_draws[0].r_attachment;
+    const bool deferred_shading = r_data->shading_mode == MCC_CPURAST_SHADING_MODE_DEFERRED;
+
+    struct scratch_allocator scratch_alloc = { .o_base = r_data->r_scratch };
+    struct tile_task_scratch scratch = tile_task_scratch_layout(&scratch_alloc, r_data->max_varying_count, deferred_shading);
+
+    if (r_attachment->o_lazy_clear)
+        lazy_clear_tile(r_attachment, r_data->tile_rect.min_x / TILE_SIZE, r_data->tile_rect.min_y / TILE_SIZE);
+
+    uint64_t coarse_dirty = 0;
+    // Fragments are counted in it if the statistics are not requested
+    struct draw_fragment_statistics ignored_statistics = {};
+    struct tile_raster_state state = {
+        .primitive = { .vertices = {
+            { .varyings = scratch.primitive_varyings[0] },
+            { .varyings = scratch.primitive_varyings[1] },
+            { .varyings = scratch.primitive_varyings[2] },
+        }},
+        .frag_input = {
+            .r_in_varyings = scratch.fragment_varyings,
+        },
+        .frag_packet_input = {
+            .r_in_varyings = scratch.packet_varyings,
+        },
+        .setup = {
+            .r_varyings = scratch.varying_planes,
+        },
+        .draw_idx = ~0u,
+    };
+    state.context = (struct mcc_rasterization_context){
+        .r_attachment = r_attachment,
+        .r_primitive = &state.primitive,
+        .r_setup = &state.setup,
+        .r_fragment_varyings = scratch.fragment_varyings,
+        .r_frag_input = &state.frag_input,
+        .r_frag_packet_input = &state.frag_packet_input,
+        .tile_rect = r_data->tile_rect,
+        .r_coarse_dirty = &coarse_dirty,
+        .o_visibility = deferred_shading ? &scratch.visibility : NULL,
+        .r_statistics = &ignored_statistics,
+    };
 
-        output_vertex_counter += clip_ctx.out_vertex_count;
+    if (deferred_shading) {
+        assert(r_data->triangle_count < VISIBILITY_SWAPPED);
+        // Sets everything to VISIBILITY_NONE
+        memset(scratch.visibility.triangles, 0xff, sizeof(*scratch.visibility.triangles) * TILE_SIZE * TILE_SIZE);
     }
 
-    r_data->out_vertex_count = output_vertex_counter;
+    // Both passes of the depth prepass use the same processed triangles
+    // when they are run by the same task
+    for (enum tile_pass pass = r_data->first_pass; pass <= r_data->last_pass; pass++)
+        tile_rasterize_triangles(r_data, &state, pass);
+
+    if (deferred_shading)
+        tile_shade_visibility(r_data, &state);
+
+    // Leave the coarse depth buffer up to date for the next renders
+    for (; coarse_dirty; coarse_dirty &= coarse_dirty - 1) {
+        const uint32_t bit = stdc_trailing_zeros(coarse_dirty);
+        coarse_depth_refresh(
+            r_attachment,
+            r_data->tile_rect.min_x / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE + bit % TILE_COARSE_BLOCKS,
+            r_data->tile_rect.min_y / MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE + bit / TILE_COARSE_BLOCKS
+        );
+    }
 
-    free(current_primitive_buffer);
     if (r_data->o_wait_counter)
         mcc_wait_counter_decrement(r_data->o_wait_counter, 1);
 }
 
-void mcc_cpurast_render(const struct mcc_cpurast_render_config *r_config) {
-    assert(r_config->r_fragment_shader->varying_count == r_config->r_vertex_shader->varying_count);
-    uint32_t varying_count = r_config->r_vertex_shader->varying_count;
+struct mcc_cpurast_command_buffer {
+    struct mcc_cpurast_render_config *draws;
+    size_t draw_count;
+    size_t draw_capacity;
+};
+
+struct mcc_cpurast_command_buffer *mcc_cpurast_command_buffer_create() {
+    struct mcc_cpurast_command_buffer *command_buffer = calloc(1, sizeof(*command_buffer));
+    assert(command_buffer != NULL);
+    return command_buffer;
+}
+
+void mcc_cpurast_command_buffer_free(struct mcc_cpurast_command_buffer *o_command_buffer) {
+    if (!o_command_buffer)
+        return;
+    free(o_command_buffer->draws);
+    free(o_command_buffer);
+}
+
+void mcc_cpurast_command_buffer_reset(struct mcc_cpurast_command_buffer *r_command_buffer) {
+    r_command_buffer->draw_count = 0;
+}
+
+void mcc_cpurast_command_buffer_draw(
+    struct mcc_cpurast_command_buffer *r_command_buffer,
+    const struct mcc_cpurast_render_config *r_config
+) {
+    validate_draw(r_config);
+    assert(r_command_buffer->draw_count == 0 || r_command_buffer->draws[0].r_attachment == r_config->r_attachment);
+    assert(r_command_buffer->draw_count == 0 || r_command_buffer->draws[0].shading_mode == r_config->shading_mode);
+
+    if (r_command_buffer->draw_count == r_command_buffer->draw_capacity) {
+        r_command_buffer->draw_capacity = mcc_max(r_command_buffer->draw_capacity * 2, 8);
+        r_command_buffer->draws = realloc(
+            r_command_buffer->draws,
+            sizeof(*r_command_buffer->draws) * r_command_buffer->draw_capacity
+        );
+        assert(r_command_buffer->draws != NULL);
+    }
+    r_command_buffer->draws[r_command_buffer->draw_count++] = *r_config;
+}
+
+/**
+ * State shared by all the batches of a submission.
+ */
+struct submit_state {
+    const struct mcc_cpurast_render_config *r_draws;
+    uint32_t draw_count;
+    struct mcc_cpurast_context *r_context;
+    struct mcc_thread_pool *r_pool;
+    uint32_t max_varying_count;
+    enum mcc_cpurast_shading_mode shading_mode;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_count_x;
+    uint32_t tile_count_y;
+    /**
+     * True if at least one draw has statistics to fill.
+     */
+    bool statistics;
+    /**
+     * The passes run by the tile tasks of the batches, see `submit_draws`.
+     */
+    enum tile_pass first_pass;
+    enum tile_pass last_pass;
+
+    struct mcc_wait_counter raster_wait_counter;
+    /**
+     * Tile tasks of the batch being rasterized, their statistics are merged
+     * once they are finished.
+     */
+    struct tile_raster_task_data *r_raster_tasks;
+    uint32_t raster_task_count;
+};
+
+/**
+ * A range of the submission's vertices (all the draws' vertices one after
+ * the other), processed then rasterized together.
+ */
+struct submit_batch {
+    /**
+     * Index of the batch's buffers in the context's ring
+     */
+    uint32_t ring_idx;
+    /**
+     * Draw of the first vertex of the batch, and the index of this vertex
+     * in the draw.
+     */
+    uint32_t draw_idx;
+    uint32_t draw_vertex_idx;
+    uint32_t vertex_count;
+
+    mcc_vec4f *r_primitive_buffer;
+    /**
+     * Start of each tile's triangle list in `r_tile_triangles`, with one
+     * additional element for the end of the last one.
+     */
+    uint32_t *r_tile_offsets;
+    /**
+     * Triangles grouped by tile.
+     */
+    struct binned_triangle *r_tile_triangles;
+};
+
+/**
+ * Runs the vertex processing tasks of the batch and then bins its triangles.
+ */
+static void process_batch(struct submit_state *r_state, struct submit_batch *r_batch) {
+    struct mcc_cpurast_context *r_context = r_state->r_context;
 
-    // TODO: For very big meshes if would make sense to break it down into
-    //       batches?
     // One element for vertex position, and one for each additional varying,
     // and all of that for each vertex (pretty big!)
     size_t primitive_buffer_size =
-        sizeof(mcc_vec4f) * (varying_count + 1) * r_config->vertex_count * MAX_SUBTRIANGLES;
-    fprintf(stderr, "primitive_buffer_size: %zu bytes\n", primitive_buffer_size);
-    mcc_vec4f *primitive_buffer = malloc(primitive_buffer_size);
-
-    // Create one task for each 32 triangles
-    const uint32_t vertex_task_size = 3 * 32;
-    const uint32_t vertex_task_count = mcc_up_div(r_config->vertex_count, vertex_task_size);
-    printf("vertex_task_count: %u\n", vertex_task_count);
-    struct vertex_process_task_data *tasks_data = malloc(sizeof(*tasks_data) * vertex_task_count);
-    
+        sizeof(mcc_vec4f) * (r_state->max_varying_count + 1) * r_batch->vertex_count * MAX_SUBTRIANGLES;
+    mcc_vec4f *primitive_buffer = scratch_buffer_reserve(
+        &r_context->primitive_buffers[r_batch->ring_idx], primitive_buffer_size
+    );
+    r_batch->r_primitive_buffer = primitive_buffer;
+    // One element for each triangle that can be stored in the primitive buffer
+    struct pixel_rect *tile_bounds_buffer = scratch_buffer_reserve(
+        &r_context->tile_bounds,
+        sizeof(*tile_bounds_buffer) * mcc_up_div(r_batch->vertex_count * MAX_SUBTRIANGLES, 3)
+    );
+
+    // Create one task for each 32 triangles, tasks do not span multiple draws
+    // so there may be one more task for each draw
+    const uint32_t max_vertex_task_count =
+        mcc_up_div(r_batch->vertex_count, VERTEX_TASK_SIZE) + r_state->draw_count;
+    struct vertex_process_task_data *tasks_data = scratch_buffer_reserve(
+        &r_context->vertex_tasks, sizeof(*tasks_data) * max_vertex_task_count
+    );
+
+    struct scratch_allocator vertex_scratch_size = {};
+    vertex_task_scratch_layout(&vertex_scratch_size, r_state->max_varying_count, r_state->max_varying_count, VERTEX_TASK_SIZE);
+    const size_t vertex_task_scratch_size = mcc_up_div(vertex_scratch_size.size, SCRATCH_ALIGNMENT) * SCRATCH_ALIGNMENT;
+    uint8_t *vertex_tasks_scratch = scratch_buffer_reserve(
+        &r_context->vertex_tasks_scratch, vertex_task_scratch_size * max_vertex_task_count
+    );
+
     struct mcc_wait_counter vertex_processing_wait_counter;
-    mcc_wait_counter_init(&vertex_processing_wait_counter, vertex_task_count);
 
-    for (uint32_t buffer_offset = 0, task_idx = 0; task_idx < vertex_task_count; task_idx++) {
-        tasks_data[task_idx] = (struct vertex_process_task_data) {
+    uint32_t vertex_task_count = 0;
+    // Position in the primitive buffer of the next task's output, in
+    // `mcc_vec4f` and in vertices
+    size_t buffer_offset = 0;
+    uint32_t buffer_vertex_offset = 0;
+    uint32_t draw_idx = r_batch->draw_idx;
+    uint32_t draw_vertex_idx = r_batch->draw_vertex_idx;
+    for (uint32_t remaining = r_batch->vertex_count; remaining > 0;) {
+        // Go to the next draw that still has vertices
+        while (draw_vertex_idx == r_state->r_draws[draw_idx].vertex_count) {
+            draw_idx++;
+            draw_vertex_idx = 0;
+        }
+        const struct mcc_cpurast_render_config *r_config = &r_state->r_draws[draw_idx];
+        const uint32_t varying_count = draw_varying_count(r_config->r_vertex_shader, r_config->o_fragment_shader);
+
+        struct vertex_process_task_data *task = &tasks_data[vertex_task_count];
+        *task = (struct vertex_process_task_data) {
             .o_fragment_shader_data = r_config->o_fragment_shader_data,
-            .r_fragment_shader = r_config->r_fragment_shader,
+            .o_fragment_shader = r_config->o_fragment_shader,
             .o_vertex_shader_data = r_config->o_vertex_shader_data,
             .r_vertex_shader = r_config->r_vertex_shader,
 
             .culling_mode = r_config->culling_mode,
             .vertex_processing = r_config->vertex_processing,
 
-            .vertex_start_idx = task_idx * vertex_task_size,
-            .vertex_count = vertex_task_size,
+            .vertex_start_idx = r_config->first_vertex + draw_vertex_idx,
+            .vertex_count = mcc_min(
+                mcc_min(VERTEX_TASK_SIZE, remaining),
+                r_config->vertex_count - draw_vertex_idx
+            ),
+            .o_indices = r_config->o_indices,
+            .draw_idx = draw_idx,
 
             .o_wait_counter = &vertex_processing_wait_counter,
+            .r_scratch = vertex_tasks_scratch + vertex_task_scratch_size * vertex_task_count,
 
-            .r_out_primitive_buffer = primitive_buffer,
+            // assigns to this task only part of the output buffer
+            .r_out_primitive_buffer = primitive_buffer + buffer_offset,
             .out_vertex_count = ~0u,
+
+            .viewport = viewport_setup(r_config),
+            .r_out_tile_bounds = tile_bounds_buffer + buffer_vertex_offset / 3,
         };
-        // Make sure we do not overflow
-        tasks_data[task_idx].vertex_count = mcc_min(
-            tasks_data[task_idx].vertex_count,
-            r_config->vertex_count - tasks_data[task_idx].vertex_start_idx
-        );
-        assert(tasks_data->vertex_count > 0);
+        assert(task->vertex_count > 0);
+        vertex_task_count++;
 
-        // assigns to this task only part of the output buffer
-        tasks_data[task_idx].r_out_primitive_buffer += buffer_offset;
         // this is the maximum amount of vertices this task can output
-        buffer_offset += (varying_count + 1) * MAX_SUBTRIANGLES * tasks_data[task_idx].vertex_count;
-        assert(buffer_offset <= (varying_count + 1) * r_config->vertex_count * MAX_SUBTRIANGLES);
+        buffer_offset += (varying_count + 1) * MAX_SUBTRIANGLES * task->vertex_count;
+        buffer_vertex_offset += MAX_SUBTRIANGLES * task->vertex_count;
+        assert(buffer_offset <= (r_state->max_varying_count + 1) * r_batch->vertex_count * MAX_SUBTRIANGLES);
+
+        draw_vertex_idx += task->vertex_count;
+        remaining -= task->vertex_count;
     }
+    assert(vertex_task_count <= max_vertex_task_count);
 
-    struct mcc_thread_pool *pool = mcc_thread_pool_global();
-    mcc_thread_pool_lock(pool);
+    mcc_wait_counter_init(&vertex_processing_wait_counter, vertex_task_count);
+
+    mcc_thread_pool_lock(r_state->r_pool);
     for (uint32_t task_idx = 0; task_idx < vertex_task_count; task_idx++) {
-        mcc_thread_pool_push_task(pool, (struct mcc_thread_pool_task){
+        mcc_thread_pool_push_task(r_state->r_pool, (struct mcc_thread_pool_task){
             .data = &tasks_data[task_idx],
             .fn = vertex_process_task,
         });
     }
-    mcc_thread_pool_unlock(pool);
+    mcc_thread_pool_unlock(r_state->r_pool);
 
     mcc_wait_counter_wait(&vertex_processing_wait_counter);
     mcc_wait_counter_free(&vertex_processing_wait_counter);
 
-    uint32_t vertex_index_increment;
-    switch (r_config->vertex_processing) {
-    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_LIST:
-        vertex_index_increment = 3;
-        break;
-    case MCC_CPURAST_VERTEX_PROCESSING_TRIANGLE_STRIP:
-        vertex_index_increment = 1;
-        break;
+    // The vertices of the depth equal pass were counted by the depth pass
+    const bool vertex_statistics = r_state->statistics && r_state->first_pass != TILE_PASS_DEPTH_EQUAL;
+    for (uint32_t task_idx = 0; vertex_statistics && task_idx < vertex_task_count; task_idx++) {
+        const struct vertex_process_task_data *task = &tasks_data[task_idx];
+        struct mcc_cpurast_pipeline_statistics *o_statistics = r_state->r_draws[task->draw_idx].o_statistics;
+        if (!o_statistics)
+            continue;
+        o_statistics->vertex_shader_invocations += task->out_statistics.vertex_shader_invocations;
+        o_statistics->input_triangles += task->out_statistics.input_triangles;
+        o_statistics->culled_triangles += task->out_statistics.culled_triangles;
+        o_statistics->clipped_triangles += task->out_statistics.clipped_triangles;
+        o_statistics->rasterized_triangles += task->out_statistics.rasterized_triangles;
     }
 
-    // Make an array of array for easy indexing
-    auto primitive_buffer_arr = (mcc_vec4f (*)[varying_count+1])primitive_buffer;
+    /*
+     * Binning: each triangle is referenced in every tile its bounds covers
+     * (and the tile mask of its draw keeps).
+     * Done with a counting sort so that, in each tile, triangles stay in
+     * submission order (the results are then identical to rasterizing all
+     * triangles one after the other).
+     */
+    const uint32_t tile_count_x = r_state->tile_count_x;
+    const uint32_t tile_count = r_state->tile_count_x * r_state->tile_count_y;
 
-    primitive_t primitive = { .vertices = {
-        { .varyings = calloc(varying_count, sizeof(mcc_vec4f)) },
-        { .varyings = calloc(varying_count, sizeof(mcc_vec4f)) },
-        { .varyings = calloc(varying_count, sizeof(mcc_vec4f)) },
-    }};
-    union mcc_cpurast_shaders_varying *fragment_varyings = calloc(varying_count, sizeof(mcc_vec4f));
+    uint32_t *tile_offsets = scratch_buffer_reserve(
+        &r_context->tile_offsets[r_batch->ring_idx], sizeof(*tile_offsets) * (tile_count + 1)
+    );
+    memset(tile_offsets, 0, sizeof(*tile_offsets) * (tile_count + 1));
+    r_batch->r_tile_offsets = tile_offsets;
 
-    struct mcc_cpurast_fragment_shader_input frag_input = {
-        .o_in_data = r_config->o_fragment_shader_data,
-        .r_in_varyings = fragment_varyings,
-    };
-    struct mcc_rasterization_context rasterizaton_context = {
-        .culling_mode = r_config->culling_mode,
-        .r_attachment = r_config->r_attachment,
-        .r_primitive = &primitive,
-        .r_fragment_varyings = fragment_varyings,
-        .r_frag_input = &frag_input,
-        .r_fragment_shader = r_config->r_fragment_shader,
-        .o_depth_comparison_fn = r_config->o_depth_comparison_fn,
-        .varying_count = varying_count,
-    };
+    for (uint32_t task_idx = 0; task_idx < vertex_task_count; task_idx++) {
+        const struct vertex_process_task_data *task = &tasks_data[task_idx];
+        const uint8_t *o_tile_mask = r_state->r_draws[task->draw_idx].o_tile_mask;
+        for (uint32_t triangle_i = 0; triangle_i < task->out_vertex_count / 3; triangle_i++) {
+            const struct pixel_rect *bounds = &task->r_out_tile_bounds[triangle_i];
+            for (uint32_t ty = bounds->min_y; ty < bounds->max_y; ty++) {
+                for (uint32_t tx = bounds->min_x; tx < bounds->max_x; tx++) {
+                    if (o_tile_mask && !o_tile_mask[tx + ty * tile_count_x])
+                        continue;
+                    tile_offsets[tx + ty * tile_count_x + 1]++;
+                }
+            }
+        }
+    }
+    for (uint32_t tile_idx = 0; tile_idx < tile_count; tile_idx++) {
+        tile_offsets[tile_idx + 1] += tile_offsets[tile_idx];
+    }
+
+    struct binned_triangle *tile_triangles = scratch_buffer_reserve(
+        &r_context->tile_triangles[r_batch->ring_idx],
+        sizeof(*tile_triangles) * mcc_max(tile_offsets[tile_count], 1u)
+    );
+    r_batch->r_tile_triangles = tile_triangles;
+    // Next free element of each tile's triangle list
+    uint32_t *tile_heads = scratch_buffer_reserve(&r_context->tile_heads, sizeof(*tile_heads) * tile_count);
+    memcpy(tile_heads, tile_offsets, sizeof(*tile_heads) * tile_count);
 
     for (uint32_t task_idx = 0; task_idx < vertex_task_count; task_idx++) {
-        const uint32_t task_buffer_start = safe_to_u32(
-            tasks_data[task_idx].r_out_primitive_buffer - primitive_buffer
-        ) / (varying_count + 1);
-        const uint32_t task_buffer_size = tasks_data[task_idx].out_vertex_count;
-        const uint32_t task_buffer_end = task_buffer_start + task_buffer_size;
-
-        for (uint32_t vertex_idx = task_buffer_start; vertex_idx < task_buffer_end; vertex_idx += vertex_index_increment) {
-            for (uint32_t sub_vert_i = 0; sub_vert_i < 3; sub_vert_i++) {
-                mcc_vec4f *vs = primitive_buffer_arr[vertex_idx + sub_vert_i];
-                primitive.vertices[sub_vert_i].pos_homogeneous = vs[0];
-                primitive.vertices[sub_vert_i].w_inv = 1.f / vs[0].w;
-                for (uint32_t varying_i = 0; varying_i < varying_count; varying_i++) {
-                    primitive.vertices[sub_vert_i].varyings[varying_i].vec4f = vs[1 + varying_i];
+        const struct vertex_process_task_data *task = &tasks_data[task_idx];
+        const uint32_t vsib = draw_varying_count(task->r_vertex_shader, task->o_fragment_shader) + 1;
+        const uint32_t task_buffer_start = safe_to_u32(task->r_out_primitive_buffer - primitive_buffer);
+        const uint8_t *o_tile_mask = r_state->r_draws[task->draw_idx].o_tile_mask;
+
+        for (uint32_t triangle_i = 0; triangle_i < task->out_vertex_count / 3; triangle_i++) {
+            const struct pixel_rect *bounds = &task->r_out_tile_bounds[triangle_i];
+            const struct binned_triangle triangle = {
+                .draw_idx = task->draw_idx,
+                .offset = task_buffer_start + triangle_i * 3 * vsib,
+            };
+            for (uint32_t ty = bounds->min_y; ty < bounds->max_y; ty++) {
+                for (uint32_t tx = bounds->min_x; tx < bounds->max_x; tx++) {
+                    if (o_tile_mask && !o_tile_mask[tx + ty * tile_count_x])
+                        continue;
+                    tile_triangles[tile_heads[tx + ty * tile_count_x]++] = triangle;
                 }
             }
+        }
+    }
+}
 
-            rasterize_triangle(&rasterizaton_context);
+/**
+ * Pushes the rasterization tasks of the batch, one for each tile that has at
+ * least one triangle, to be waited on with `wait_batch_rasterization`.
+ */
+static void start_batch_rasterization(struct submit_state *r_state, const struct submit_batch *r_batch) {
+    struct mcc_cpurast_context *r_context = r_state->r_context;
+    const uint32_t tile_count = r_state->tile_count_x * r_state->tile_count_y;
+
+    struct tile_raster_task_data *tile_tasks_data = scratch_buffer_reserve(
+        &r_context->tile_tasks, sizeof(*tile_tasks_data) * tile_count
+    );
+
+    struct scratch_allocator tile_scratch_size = {};
+    tile_task_scratch_layout(&tile_scratch_size, r_state->max_varying_count, r_state->shading_mode == MCC_CPURAST_SHADING_MODE_DEFERRED);
+    const size_t tile_task_scratch_size = mcc_up_div(tile_scratch_size.size, SCRATCH_ALIGNMENT) * SCRATCH_ALIGNMENT;
+    uint8_t *tile_tasks_scratch = scratch_buffer_reserve(
+        &r_context->tile_tasks_scratch, tile_task_scratch_size * tile_count
+    );
+    // One element for each binned triangle, the worst case of each draw
+    // being followed by another one in every tile
+    struct draw_fragment_statistics *tile_statistics = !r_state->statistics ? NULL : scratch_buffer_reserve(
+        &r_context->tile_statistics,
+        sizeof(*tile_statistics) * mcc_max(r_batch->r_tile_offsets[tile_count], 1u)
+    );
+
+    uint32_t tile_task_count = 0;
+    for (uint32_t ty = 0; ty < r_state->tile_count_y; ty++) {
+        for (uint32_t tx = 0; tx < r_state->tile_count_x; tx++) {
+            const uint32_t tile_idx = tx + ty * r_state->tile_count_x;
+            const uint32_t triangle_count = r_batch->r_tile_offsets[tile_idx + 1] - r_batch->r_tile_offsets[tile_idx];
+            if (triangle_count == 0)
+                continue;
+
+            tile_tasks_data[tile_task_count] = (struct tile_raster_task_data){
+                .r_draws = r_state->r_draws,
+                .max_varying_count = r_state->max_varying_count,
+                .shading_mode = r_state->shading_mode,
+                .first_pass = r_state->first_pass,
+                .last_pass = r_state->last_pass,
+                .r_primitive_buffer = r_batch->r_primitive_buffer,
+                .r_triangles = &r_batch->r_tile_triangles[r_batch->r_tile_offsets[tile_idx]],
+                .triangle_count = triangle_count,
+                .tile_rect = {
+                    .min_x = tx * TILE_SIZE,
+                    .min_y = ty * TILE_SIZE,
+                    .max_x = mcc_min((tx + 1) * TILE_SIZE, r_state->width),
+                    .max_y = mcc_min((ty + 1) * TILE_SIZE, r_state->height),
+                },
+                .r_scratch = tile_tasks_scratch + tile_task_scratch_size * tile_task_count,
+                .o_statistics = tile_statistics ? &tile_statistics[r_batch->r_tile_offsets[tile_idx]] : NULL,
+                .o_wait_counter = &r_state->raster_wait_counter,
+            };
+            tile_task_count++;
         }
     }
 
-    for (size_t i = 0; i < 3; i++) {
-        free(primitive.vertices[i].varyings);
+    mcc_wait_counter_init(&r_state->raster_wait_counter, tile_task_count);
+    r_state->r_raster_tasks = tile_tasks_data;
+    r_state->raster_task_count = tile_task_count;
+
+    mcc_thread_pool_lock(r_state->r_pool);
+    for (uint32_t task_idx = 0; task_idx < tile_task_count; task_idx++) {
+        mcc_thread_pool_push_task(r_state->r_pool, (struct mcc_thread_pool_task){
+            .data = &tile_tasks_data[task_idx],
+            .fn = tile_raster_task,
+        });
     }
-    free(fragment_varyings);
-    free(primitive_buffer);
+    mcc_thread_pool_unlock(r_state->r_pool);
+}
+
+static void wait_batch_rasterization(struct submit_state *r_state) {
+    mcc_wait_counter_wait(&r_state->raster_wait_counter);
+    mcc_wait_counter_free(&r_state->raster_wait_counter);
+
+    for (uint32_t task_idx = 0; r_state->statistics && task_idx < r_state->raster_task_count; task_idx++) {
+        const struct tile_raster_task_data *task = &r_state->r_raster_tasks[task_idx];
+        for (uint32_t i = 0; i < task->out_statistics_count; i++) {
+            const struct draw_fragment_statistics *fragment_statistics = &task->o_statistics[i];
+            struct mcc_cpurast_pipeline_statistics *o_statistics = r_state->r_draws[fragment_statistics->draw_idx].o_statistics;
+            if (!o_statistics)
+                continue;
+            o_statistics->depth_tested_fragments += fragment_statistics->depth_tested_fragments;
+            o_statistics->samples_passed += fragment_statistics->samples_passed;
+            o_statistics->fragment_shader_invocations += fragment_statistics->fragment_shader_invocations;
+        }
+    }
+}
+
+/**
+ * Processes and rasterizes all the vertices of the submission, running the
+ * passes of the state on each batch.
+ */
+static void stream_batches(struct submit_state *r_state, uint32_t total_vertex_count) {
+    /*
+     * The submission is streamed in batches: while a batch is rasterized the
+     * next one is processed into the next buffers of the ring, which can be
+     * reused as soon as the batch that last used them finished rasterizing.
+     * Batches are rasterized one after the other so the results are the same
+     * as for a single batch.
+     */
+    const uint32_t batch_count = mcc_up_div(total_vertex_count, STREAM_BATCH_VERTEX_COUNT);
+    struct submit_batch batches[STREAM_RING_SIZE];
+    const struct mcc_cpurast_render_config *r_draws = r_state->r_draws;
+    uint32_t draw_idx = 0;
+    uint32_t draw_vertex_idx = 0;
+    for (uint32_t batch_idx = 0; batch_idx < batch_count; batch_idx++) {
+        const uint32_t ring_idx = batch_idx % STREAM_RING_SIZE;
+        batches[ring_idx] = (struct submit_batch){
+            .ring_idx = ring_idx,
+            .draw_idx = draw_idx,
+            .draw_vertex_idx = draw_vertex_idx,
+            .vertex_count = mcc_min(
+                STREAM_BATCH_VERTEX_COUNT,
+                total_vertex_count - batch_idx * STREAM_BATCH_VERTEX_COUNT
+            ),
+        };
+        // Processed while the previous batch is being rasterized
+        process_batch(r_state, &batches[ring_idx]);
+
+        if (batch_idx > 0)
+            wait_batch_rasterization(r_state);
+        start_batch_rasterization(r_state, &batches[ring_idx]);
+
+        // Start of the next batch
+        draw_vertex_idx += batches[ring_idx].vertex_count;
+        while (draw_idx < r_state->draw_count && draw_vertex_idx >= r_draws[draw_idx].vertex_count) {
+            draw_vertex_idx -= r_draws[draw_idx].vertex_count;
+            draw_idx++;
+        }
+    }
+    if (batch_count > 0)
+        wait_batch_rasterization(r_state);
+}
+
+/**
+ * Renders the given draws as if they were rendered one after the other.
+ */
+static void submit_draws(
+    const struct mcc_cpurast_render_config *r_draws, uint32_t draw_count,
+    struct mcc_cpurast_context *o_context
+) {
+    if (draw_count == 0)
+        return;
+
+    const struct mcc_cpurast_rendering_attachment *r_attachment = r_draws[0].r_attachment;
+    struct submit_state state = {
+        .r_draws = r_draws,
+        .draw_count = draw_count,
+        .r_context = o_context,
+        .r_pool = mcc_thread_pool_global(),
+        .shading_mode = r_draws[0].shading_mode,
+        .width = r_attachment->width,
+        .height = r_attachment->height,
+        .tile_count_x = mcc_up_div(r_attachment->width, TILE_SIZE),
+        .tile_count_y = mcc_up_div(r_attachment->height, TILE_SIZE),
+    };
+    if (!state.r_context)
+        state.r_context = mcc_cpurast_context_create();
+
+    uint32_t total_vertex_count = 0;
+    for (uint32_t draw_idx = 0; draw_idx < draw_count; draw_idx++) {
+        assert(r_draws[draw_idx].r_attachment == r_attachment);
+        assert(r_draws[draw_idx].shading_mode == r_draws[0].shading_mode);
+        total_vertex_count += r_draws[draw_idx].vertex_count;
+        state.max_varying_count = mcc_max(state.max_varying_count, r_draws[draw_idx].r_vertex_shader->varying_count);
+        if (r_draws[draw_idx].o_statistics) {
+            *r_draws[draw_idx].o_statistics = (struct mcc_cpurast_pipeline_statistics){};
+            state.statistics = true;
+        }
+    }
+
+    const uint32_t batch_count = mcc_up_div(total_vertex_count, STREAM_BATCH_VERTEX_COUNT);
+    if (state.shading_mode != MCC_CPURAST_SHADING_MODE_DEPTH_PREPASS) {
+        state.first_pass = state.last_pass = TILE_PASS_SHADE;
+        stream_batches(&state, total_vertex_count);
+    } else if (batch_count <= 1) {
+        state.first_pass = TILE_PASS_DEPTH;
+        state.last_pass = TILE_PASS_DEPTH_EQUAL;
+        stream_batches(&state, total_vertex_count);
+    } else {
+        // A pixel may be covered by a nearer triangle of a later batch, so
+        // every batch is depth tested before any is shaded, the vertices
+        // being processed again for the second pass
+        state.first_pass = state.last_pass = TILE_PASS_DEPTH;
+        stream_batches(&state, total_vertex_count);
+        state.first_pass = state.last_pass = TILE_PASS_DEPTH_EQUAL;
+        stream_batches(&state, total_vertex_count);
+    }
+
+    if (!o_context)
+        mcc_cpurast_context_free(state.r_context);
+}
+
+void mcc_cpurast_command_buffer_submit(
+    const struct mcc_cpurast_command_buffer *r_command_buffer,
+    struct mcc_cpurast_context *o_context
+) {
+    submit_draws(r_command_buffer->draws, safe_to_u32(r_command_buffer->draw_count), o_context);
+}
+
+void mcc_cpurast_render(const struct mcc_cpurast_render_config *r_config) {
+    validate_draw(r_config);
+    submit_draws(r_config, 1, r_config->o_context);
 }
@@ -2,6 +2,7 @@
 
 #include "defs.h"
 #include "color/color.h"
+#include "linalg/matrix.h"
 #include "linalg/vector.h"
 
 #include <stddef.h>
@@ -14,20 +15,112 @@ struct mcc_cpurast_rendering_color_attachment {
     uint8_t *r_data;
 };
 
+/**
+ * Width and height (in pixels) of the blocks of the coarse depth buffer.
+ */
+#define MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE 8
+
 struct mcc_cpurast_rendering_depth_attachment {
     /**
      * Only one format is supported: float32
      */
     float32_t *r_data;
+    /**
+     * Optional coarse (hierarchical) depth buffer, with one element for each
+     * MCC_CPURAST_COARSE_DEPTH_BLOCK_SIZE^2 block of pixels, row major, of
+     * `mcc_cpurast_coarse_depth_size` elements.
+     * Each element holds the farthest (greatest) depth of its block, which
+     * allows rejecting whole blocks when the depth comparison function is
+     * `mcc_depth_comparison_fn_lt` or `mcc_depth_comparison_fn_lte`.
+     *
+     * It is kept up to date by `mcc_cpurast_clear` and `mcc_cpurast_render`,
+     * writing to `r_data` by any other mean invalidates it.
+     */
+    float32_t *o_coarse_data;
+};
+
+/**
+ * Number of elements of the coarse depth buffer of a depth attachment of the
+ * given size.
+ */
+size_t mcc_cpurast_coarse_depth_size(uint32_t width, uint32_t height);
+
+/**
+ * Clears of an attachment that are not done yet, see
+ * `mcc_cpurast_clear_config.lazy`.
+ */
+struct mcc_cpurast_lazy_clear {
+    /**
+     * One element for each tile of the attachment, of
+     * `mcc_cpurast_lazy_clear_tile_count` elements, must be zeroed before
+     * the first use.
+     */
+    uint8_t *r_tiles;
+    /**
+     * Set by `mcc_cpurast_clear`.
+     */
+    uint32_t packed_color;
+    float32_t depth;
+};
+
+/**
+ * Width and height (in pixels) of the blocks of the blocked attachment
+ * layout.
+ */
+#define MCC_CPURAST_ATTACHMENT_BLOCK_SIZE 8
+
+/**
+ * Order of the pixels in the data of the color and depth attachments.
+ */
+enum mcc_cpurast_attachment_layout {
+    /**
+     * Rows of pixels one after the other.
+     */
+    MCC_CPURAST_ATTACHMENT_LAYOUT_LINEAR,
+    /**
+     * MCC_CPURAST_ATTACHMENT_BLOCK_SIZE^2 blocks of pixels one after the
+     * other (row major), the pixels of each block being row major.
+     * The size of the attachments is rounded up to a whole number of blocks.
+     * Keeps the pixels near each other in the same cache lines, but the
+     * color attachment must be converted with `mcc_cpurast_resolve_color`
+     * before being displayed.
+     */
+    MCC_CPURAST_ATTACHMENT_LAYOUT_BLOCKED,
 };
 
 struct mcc_cpurast_rendering_attachment {
     const struct mcc_cpurast_rendering_depth_attachment *o_depth;
     const struct mcc_cpurast_rendering_color_attachment *o_color;
+    /**
+     * Required for lazy clears.
+     */
+    struct mcc_cpurast_lazy_clear *o_lazy_clear;
+    uint32_t width;
+    uint32_t height;
+    enum mcc_cpurast_attachment_layout layout;
+};
+
+/**
+ * Rectangle of pixels of an attachment, (x, y) being its top left corner.
+ */
+struct mcc_cpurast_rect {
+    uint32_t x;
+    uint32_t y;
     uint32_t width;
     uint32_t height;
 };
 
+/**
+ * Number of pixels of the color and depth attachments of the given size and
+ * layout.
+ */
+size_t mcc_cpurast_attachment_pixel_count(uint32_t width, uint32_t height, enum mcc_cpurast_attachment_layout layout);
+
+/**
+ * Number of tiles of the lazy clear of an attachment of the given size.
+ */
+size_t mcc_cpurast_lazy_clear_tile_count(uint32_t width, uint32_t height);
+
 union mcc_cpurast_shaders_varying {
     /**
      * For now this is the only possible type for varying parameters
@@ -49,8 +142,54 @@ struct mcc_cpurast_vertex_shader_input {
 
 typedef void (*mcc_vertex_shader_fn)(struct mcc_cpurast_vertex_shader_input*);
 
+/**
+ * Maximum number of vertices given at once to batch vertex shaders.
+ */
+#define MCC_CPURAST_VERTEX_BATCH_SIZE 8
+
+/**
+ * Same as `mcc_cpurast_vertex_shader_input` but for a batch of up to
+ * MCC_CPURAST_VERTEX_BATCH_SIZE vertices, in structure of arrays
+ * form (the last index is always the vertex's).
+ */
+struct mcc_cpurast_vertex_batch_input {
+    void *o_in_data;
+
+    /**
+     * The batch is made of the first `in_vertex_count` vertices of
+     * `in_vertex_indices`, the outputs of the remaining elements of the arrays
+     * are ignored.
+     */
+    uint32_t in_vertex_indices[MCC_CPURAST_VERTEX_BATCH_SIZE];
+    uint32_t in_vertex_count;
+
+    /**
+     * Pre alocated array of varyings of the length specified in the vertex
+     * struct, each varying being made of its x, y, z and w components.
+     */
+    float (*r_out_varyings)[4][MCC_CPURAST_VERTEX_BATCH_SIZE];
+
+    /**
+     * x, y, z and w components of the vertices positions.
+     */
+    float out_position[4][MCC_CPURAST_VERTEX_BATCH_SIZE];
+};
+
+typedef void (*mcc_vertex_shader_batch_fn)(struct mcc_cpurast_vertex_batch_input*);
+
 struct mcc_vertex_shader {
     mcc_vertex_shader_fn r_fn;
+    /**
+     * Optional, if not NULL it is used instead of `r_fn` to shade whole
+     * batches of vertices at once, and must give the same results.
+     */
+    mcc_vertex_shader_batch_fn o_batch_fn;
+    /**
+     * Optional, if not NULL it is used instead of the others for the draws
+     * keeping no varyings (without fragment shader), it only writes
+     * `out_position` of the batch and `r_out_varyings` is NULL.
+     */
+    mcc_vertex_shader_batch_fn o_position_batch_fn;
     /**
      * Number of varying parameters this shader will output.
      */
@@ -72,8 +211,52 @@ struct mcc_cpurast_fragment_shader_input {
 
 typedef void (*mcc_fragment_shader_fn)(struct mcc_cpurast_fragment_shader_input*);
 
+/**
+ * Number of fragments given at once to packet fragment shaders.
+ */
+#define MCC_CPURAST_FRAGMENT_PACKET_SIZE 8
+
+/**
+ * Same as `mcc_cpurast_fragment_shader_input` but for a packet of
+ * MCC_CPURAST_FRAGMENT_PACKET_SIZE horizontally adjacent fragments, in
+ * structure of arrays form (the last index is always the fragment's).
+ */
+struct mcc_cpurast_fragment_packet_input {
+    void *o_in_data;
+
+    /**
+     * The nth bit is set if the nth fragment of the packet must be shaded,
+     * the inputs of the other fragments are unspecified and their outputs
+     * ignored.
+     */
+    uint32_t in_active_mask;
+
+    /**
+     * Length is as defined in the fragment shader struct, each varying
+     * being made of its x, y, z and w components.
+     */
+    float (*r_in_varyings)[4][MCC_CPURAST_FRAGMENT_PACKET_SIZE];
+
+    /**
+     * x, y and z components of the fragments coordinates.
+     */
+    float in_frag_coord[3][MCC_CPURAST_FRAGMENT_PACKET_SIZE];
+
+    /**
+     * r, g, b and a components of the fragments colors.
+     */
+    float out_color[4][MCC_CPURAST_FRAGMENT_PACKET_SIZE];
+};
+
+typedef void (*mcc_fragment_shader_packet_fn)(struct mcc_cpurast_fragment_packet_input*);
+
 struct mcc_fragment_shader {
     mcc_fragment_shader_fn r_fn;
+    /**
+     * Optional, if not NULL it is used instead of `r_fn` to shade whole
+     * packets of fragments at once, and must give the same results.
+     */
+    mcc_fragment_shader_packet_fn o_packet_fn;
     /**
      * Number of varying parameters this shader will output.
      */
@@ -90,9 +273,74 @@ struct mcc_cpurast_clear_config {
      * Ignored if `r_attachment->o_color` is NULL
      */
     struct mcc_color_rgba clear_color;
+    /**
+     * If true, `r_attachment->o_lazy_clear` must not be NULL and the
+     * attachments are not written: each tile is only cleared when it is
+     * first rendered to, or by `mcc_cpurast_finish_clear`.
+     * The coarse depth buffer is still cleared right away.
+     */
+    bool lazy;
 };
 
 void mcc_cpurast_clear(const struct mcc_cpurast_clear_config *r_config);
+/**
+ * Does the lazy clears not done yet, to be called before reading the
+ * attachments.
+ * Does nothing if `r_attachment->o_lazy_clear` is NULL.
+ */
+void mcc_cpurast_finish_clear(const struct mcc_cpurast_rendering_attachment *r_attachment);
+
+/**
+ * Writes the color attachment of `r_attachment` to `r_out_data` as
+ * `width * height` linear BGRA pixels, in parallel.
+ * The tiles with a pending lazy clear are resolved to the clear color
+ * without being cleared.
+ */
+void mcc_cpurast_resolve_color(const struct mcc_cpurast_rendering_attachment *r_attachment, uint8_t *r_out_data);
+
+struct mcc_cpurast_reproject_config {
+    /**
+     * The previous frame, with color and depth attachments of the same size
+     * and layout as `r_attachment` and no pending lazy clear.
+     */
+    const struct mcc_cpurast_rendering_attachment *r_previous_attachment;
+    /**
+     * Transformation from world space to the clip space of the previous
+     * frame.
+     */
+    mcc_mat4f previous_view_projection;
+    /**
+     * The new frame, with color and depth attachments and a lazy clear of
+     * both of them pending on all tiles.
+     */
+    const struct mcc_cpurast_rendering_attachment *r_attachment;
+    /**
+     * Transformation from world space to the clip space of the new frame.
+     */
+    mcc_mat4f view_projection;
+    /**
+     * One element for each tile, of `mcc_cpurast_lazy_clear_tile_count`
+     * elements, set to 1 for the tiles to render again and 0 for the
+     * others, to be given to `mcc_cpurast_render_config.o_tile_mask`.
+     */
+    uint8_t *r_out_tile_mask;
+};
+
+/**
+ * Builds the new frame from the previous one, in parallel: each pixel of the
+ * new frame takes the color and depth of the pixel of the previous frame
+ * that moves to it.
+ * The tiles where all pixels were found have their lazy clear cancelled (and
+ * their coarse depth updated), the others, with pixels coming from outside
+ * of the previous frame or from behind surfaces it showed, keep their
+ * lazy clear and are to be rendered again.
+ * Exact, up to a resampling to the nearest pixel, when the camera only
+ * rotates. When it moves, pixels next to the edges of surfaces may take the
+ * color of a surface now hidden, so frames should regularly be fully
+ * rendered.
+ * Returns the number of tiles to render again.
+ */
+size_t mcc_cpurast_reproject(const struct mcc_cpurast_reproject_config *r_config);
 
 enum mcc_cpurast_culling_mode {
     MCC_CPURAST_CULLING_MODE_NONE,
@@ -106,6 +354,36 @@ enum mcc_cpurast_polygon_mode {
     MCC_CPURAST_POLYGON_MODE_POINT,
 };
 
+enum mcc_cpurast_shading_mode {
+    /**
+     * Fragments are shaded as soon as they pass the depth test, even if
+     * they are covered by later triangles.
+     */
+    MCC_CPURAST_SHADING_MODE_FORWARD,
+    /**
+     * Triangles are first rasterized into a visibility buffer (depth,
+     * triangle and barycentric coordinates of each pixel), then each pixel
+     * is shaded only once, with the same results as forward shading.
+     * Shading cost no longer depends on depth complexity, but with
+     * submissions too big to be rasterized at once (see
+     * `mcc_cpurast_render`) pixels may be shaded once for each part.
+     */
+    MCC_CPURAST_SHADING_MODE_DEFERRED,
+    /**
+     * The triangles of each tile are first rasterized depth only, then
+     * rasterized again to only shade the fragments whose depth is equal to
+     * the final one, reusing the same processed vertices.
+     * Cheaper than deferred shading for shaders with few varyings, but
+     * fragments of triangles with exactly the same depth are all shaded
+     * (the last one being kept).
+     * Submissions too big to be rasterized at once have all their parts
+     * rasterized depth only before any is shaded, so their vertices are
+     * processed twice.
+     * Requires a depth attachment.
+     */
+    MCC_CPURAST_SHADING_MODE_DEPTH_PREPASS,
+};
+
 enum mcc_cpurast_vertex_processing {
     /**
      * Each set of 3 vertices represent the 3 corner of each triangle.
@@ -128,14 +406,98 @@ bool mcc_depth_comparison_fn_lte(float previous, float new);
 bool mcc_depth_comparison_fn_eq(float previous, float new);
 bool mcc_depth_comparison_fn_neq(float previous, float new);
 
+/**
+ * Owns the scratch memory used to render (see `mcc_cpurast_render`), which is only ever
+ * grown so that, once warmed up, rendering with the same context does no
+ * heap allocation.
+ * A context must not be used by multiple renders at the same time.
+ */
+struct mcc_cpurast_context;
+
+struct mcc_cpurast_context *mcc_cpurast_context_create();
+void mcc_cpurast_context_free(struct mcc_cpurast_context *o_context);
+
+/**
+ * Counters of the work done to render a draw, the equivalent of OpenGL's
+ * pipeline statistics and occlusion queries.
+ */
+struct mcc_cpurast_pipeline_statistics {
+    /**
+     * Number of vertices shaded, vertices referenced multiple times by an
+     * index buffer may only be shaded once.
+     */
+    uint64_t vertex_shader_invocations;
+    /**
+     * Number of triangles assembled from the vertices.
+     */
+    uint64_t input_triangles;
+    /**
+     * Input triangles discarded before clipping, for being fully outside of
+     * the clip volume or back facing.
+     */
+    uint64_t culled_triangles;
+    /**
+     * Input triangles crossing the near or far plane, or extending so far
+     * outside of the view that they must be clipped for the rasterizer.
+     */
+    uint64_t clipped_triangles;
+    /**
+     * Triangles given to the rasterizer, after culling and clipping.
+     */
+    uint64_t rasterized_triangles;
+    /**
+     * Fragments covered by the triangles that had their depth tested
+     * (fragments of blocks rejected by the coarse depth buffer are not
+     * counted).
+     */
+    uint64_t depth_tested_fragments;
+    /**
+     * Fragments that passed the depth test (all of the covered fragments
+     * without a depth attachment), the result of an occlusion query: a draw
+     * with no samples passed is fully hidden.
+     */
+    uint64_t samples_passed;
+    /**
+     * Fragments shaded, smaller than `samples_passed` with deferred
+     * shading when triangles are covered by later ones.
+     */
+    uint64_t fragment_shader_invocations;
+};
+
 struct mcc_cpurast_render_config {
     struct mcc_cpurast_rendering_attachment *r_attachment;
+    /**
+     * If NULL, a context is created and freed for this render only.
+     * Ignored for draws recorded in a command buffer.
+     */
+    struct mcc_cpurast_context *o_context;
 
     void *o_fragment_shader_data;
-    struct mcc_fragment_shader *r_fragment_shader;
+    /**
+     * If NULL, the draw is depth only: `r_attachment` must not have a color
+     * attachment, the varyings output by the vertex shader are dropped as
+     * soon as it ran and the fragments passing the depth test only have
+     * their depth written.
+     */
+    struct mcc_fragment_shader *o_fragment_shader;
     void *o_vertex_shader_data;
     struct mcc_vertex_shader *r_vertex_shader;
 
+    /**
+     * Pixels the normalized device coordinates are mapped to, (-1, 1) being
+     * the top left corner of the rectangle and (1, -1) its bottom right
+     * corner. It may extend outside of the attachment.
+     * Pixels outside of the viewport are never written.
+     * If its width or height is 0, the whole attachment is used.
+     */
+    struct mcc_cpurast_rect viewport;
+    /**
+     * Only the pixels inside of this rectangle (and of the attachment) are
+     * rendered to, triangles outside of it are not binned to any tile.
+     * If its width or height is 0, the whole attachment is used.
+     */
+    struct mcc_cpurast_rect scissor;
+
     enum mcc_cpurast_culling_mode culling_mode;
     /**
      * Controls how triangles are rendered:
@@ -143,9 +505,16 @@ struct mcc_cpurast_render_config {
      * - LINE: only renders triangle edges (wireframe)
      * - POINT: only renders triangle vertices
      *
-     * WARNING: IGNORED, for now, always in FILL mode.
+     * Only the pixels of the edges (one for each column, or row for mostly
+     * vertical edges) or of the vertices are depth tested and shaded.
+     * Triangles are culled as in FILL mode, and triangles clipped against
+     * the near and far planes show the edges of the clipped triangles.
      */
     enum mcc_cpurast_polygon_mode polygon_mode;
+    /**
+     * Must be the same for all draws of a command buffer.
+     */
+    enum mcc_cpurast_shading_mode shading_mode;
     /**
      * Ignored if r_attachment->o_depth is NULL.
      * 
@@ -159,14 +528,72 @@ struct mcc_cpurast_render_config {
      */
     mcc_depth_comparison_fn o_depth_comparison_fn;
 
+    /**
+     * Index of the first vertex to render (or of the first index to read if
+     * `o_indices` is not NULL).
+     */
+    uint32_t first_vertex;
     /**
      * Number of vertices to render. For now there is no vertex buffers, use internal ones!
+     * If `o_indices` is not NULL, this is the number of indices to read.
      */
     uint32_t vertex_count;
+    /**
+     * Optional index buffer of `vertex_count` elements, if not NULL the nth
+     * vertex of the primitives is the vertex `o_indices[n]`, and vertices
+     * referenced multiple times are shaded only once as far as possible.
+     */
+    const uint32_t *o_indices;
     /**
      * How to process each vertices.
      */
     enum mcc_cpurast_vertex_processing vertex_processing;
+
+    /**
+     * If not NULL, set to the statistics of the draw once it is rendered
+     * (the sum of the statistics of the draws of a submission sharing it).
+     */
+    struct mcc_cpurast_pipeline_statistics *o_statistics;
+    /**
+     * If not NULL, one element for each tile of the attachment, of
+     * `mcc_cpurast_lazy_clear_tile_count` elements: the draw only renders to
+     * the tiles whose element is not zero, the others are left untouched
+     * (a scissor with the granularity of tiles).
+     */
+    const uint8_t *o_tile_mask;
 };
 
 void mcc_cpurast_render(const struct mcc_cpurast_render_config *r_config);
+
+/**
+ * Records draws to render them all in a single submission, which processes
+ * the vertices of all draws in parallel and bins all their triangles
+ * together instead of waiting for each draw to be finished.
+ */
+struct mcc_cpurast_command_buffer;
+
+struct mcc_cpurast_command_buffer *mcc_cpurast_command_buffer_create();
+void mcc_cpurast_command_buffer_free(struct mcc_cpurast_command_buffer *o_command_buffer);
+/**
+ * Removes all recorded draws, keeping the memory for the next ones.
+ */
+void mcc_cpurast_command_buffer_reset(struct mcc_cpurast_command_buffer *r_command_buffer);
+/**
+ * Records a draw, the config is copied but everything it points to must
+ * stay valid until the command buffer is submitted.
+ * All draws of a command buffer must have the same attachment.
+ */
+void mcc_cpurast_command_buffer_draw(
+    struct mcc_cpurast_command_buffer *r_command_buffer,
+    const struct mcc_cpurast_render_config *r_config
+);
+/**
+ * Renders all the recorded draws, with the same results as rendering them
+ * one after the other.
+ * If `o_context` is NULL, a context is created and freed for this submission
+ * only.
+ */
+void mcc_cpurast_command_buffer_submit(
+    const struct mcc_cpurast_command_buffer *r_command_buffer,
+    struct mcc_cpurast_context *o_context
+);
@@ -0,0 +1,273 @@
+#include "occlusion.h"
+#include "linalg/simd.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbit.h>
+#include <stdlib.h>
+
+struct mcc_occlusion_buffer {
+    uint32_t width;
+    uint32_t height;
+    /**
+     * Number of elements between the start of two rows, a multiple of
+     * MCC_SIMD_WIDTH so that rows can always be read MCC_SIMD_WIDTH pixels at
+     * a time.
+     */
+    uint32_t stride;
+    /**
+     * Depth of the nearest occluder of each pixel, row major.
+     */
+    float *depth;
+};
+
+struct mcc_occlusion_buffer *mcc_occlusion_buffer_create(uint32_t width, uint32_t height) {
+    assert(width > 0 && height > 0);
+
+    struct mcc_occlusion_buffer *buffer = calloc(1, sizeof(*buffer));
+    assert(buffer != NULL);
+    buffer->width = width;
+    buffer->height = height;
+    buffer->stride = mcc_up_div(width, MCC_SIMD_WIDTH) * MCC_SIMD_WIDTH;
+    buffer->depth = malloc(sizeof(*buffer->depth) * buffer->stride * height);
+    assert(buffer->depth != NULL);
+
+    mcc_occlusion_buffer_clear(buffer);
+    return buffer;
+}
+
+void mcc_occlusion_buffer_free(struct mcc_occlusion_buffer *o_buffer) {
+    if (!o_buffer)
+        return;
+    free(o_buffer->depth);
+    free(o_buffer);
+}
+
+void mcc_occlusion_buffer_clear(struct mcc_occlusion_buffer *r_buffer) {
+    const mcc_f32x8 far = mcc_f32x8_splat(1.f);
+    const size_t count = (size_t)r_buffer->stride * r_buffer->height;
+    for (size_t i = 0; i < count; i += MCC_SIMD_WIDTH)
+        mcc_f32x8_store(&r_buffer->depth[i], far);
+}
+
+/**
+ * Position of a vertex in the pixel coordinates of the buffer (y pointing
+ * down), with its normalized device coordinates depth.
+ */
+struct occluder_vertex {
+    float x;
+    float y;
+    float depth;
+};
+
+/**
+ * Edge function `a * x + b * y + c`, positive on the inner side of the edge.
+ */
+struct occluder_edge {
+    float a;
+    float b;
+    float c;
+};
+
+static struct occluder_edge occluder_edge_setup(struct occluder_vertex from, struct occluder_vertex to) {
+    struct occluder_edge edge = {
+        .a = from.y - to.y,
+        .b = to.x - from.x,
+    };
+    edge.c = -(edge.a * from.x + edge.b * from.y);
+    return edge;
+}
+
+static void draw_occluder_triangle(struct mcc_occlusion_buffer *r_buffer, struct occluder_vertex vs[3], enum mcc_cpurast_culling_mode culling_mode) {
+    // Twice the area of the triangle, with the same sign as the edge
+    // functions inside of it, positive for the triangles `rasterize_triangle`
+    // considers counter clockwise
+    float area = (vs[1].x - vs[0].x) * (vs[2].y - vs[0].y)
+               - (vs[1].y - vs[0].y) * (vs[2].x - vs[0].x);
+    if (!(area != 0.f))
+        return;
+
+    bool isCcw = area > 0.f;
+    if ((culling_mode == MCC_CPURAST_CULLING_MODE_CW && isCcw) ||
+        (culling_mode == MCC_CPURAST_CULLING_MODE_CCW && !isCcw))
+        return;
+
+    if (area < 0.f) {
+        struct occluder_vertex tv = vs[1];
+        vs[1] = vs[2];
+        vs[2] = tv;
+        area = -area;
+    }
+
+    const float min_x = fmaxf(floorf(fminf(vs[0].x, fminf(vs[1].x, vs[2].x))), 0.f),
+                min_y = fmaxf(floorf(fminf(vs[0].y, fminf(vs[1].y, vs[2].y))), 0.f),
+                max_x = fminf(ceilf(fmaxf(vs[0].x, fmaxf(vs[1].x, vs[2].x))), (float)r_buffer->width),
+                max_y = fminf(ceilf(fmaxf(vs[0].y, fmaxf(vs[1].y, vs[2].y))), (float)r_buffer->height);
+    if (!(min_x < max_x && min_y < max_y))
+        return;
+    const uint32_t x_start = (uint32_t)min_x / MCC_SIMD_WIDTH * MCC_SIMD_WIDTH,
+                   x_end = (uint32_t)max_x,
+                   y_start = (uint32_t)min_y,
+                   y_end = (uint32_t)max_y;
+
+    const struct occluder_edge edges[3] = {
+        occluder_edge_setup(vs[0], vs[1]),
+        occluder_edge_setup(vs[1], vs[2]),
+        occluder_edge_setup(vs[2], vs[0]),
+    };
+    // Depth plane, evaluated at the farthest point of each pixel (and never
+    // farther than the triangle) so that the occluder is never nearer than
+    // the triangle
+    const float depth_dx = ((vs[1].depth - vs[0].depth) * (vs[2].y - vs[0].y) - (vs[2].depth - vs[0].depth) * (vs[1].y - vs[0].y)) / area,
+                depth_dy = ((vs[2].depth - vs[0].depth) * (vs[1].x - vs[0].x) - (vs[1].depth - vs[0].depth) * (vs[2].x - vs[0].x)) / area;
+    const float depth_offset = vs[0].depth + 0.5f * (fabsf(depth_dx) + fabsf(depth_dy));
+    const mcc_f32x8 max_depth = mcc_f32x8_splat(fmaxf(vs[0].depth, fmaxf(vs[1].depth, vs[2].depth)));
+    const mcc_f32x8 depth_step = mcc_f32x8_mul(mcc_f32x8_lane_indices(), mcc_f32x8_splat(depth_dx));
+
+    mcc_f32x8 edge_steps[3];
+    for (size_t edge_i = 0; edge_i < 3; edge_i++)
+        edge_steps[edge_i] = mcc_f32x8_mul(mcc_f32x8_lane_indices(), mcc_f32x8_splat(edges[edge_i].a));
+    const mcc_f32x8 zero = mcc_f32x8_splat(0.f);
+
+    for (uint32_t y = y_start; y < y_end; y++) {
+        float *row = &r_buffer->depth[(size_t)y * r_buffer->stride];
+        for (uint32_t x = x_start; x < x_end; x += MCC_SIMD_WIDTH) {
+            uint32_t mask = x_end - x < MCC_SIMD_WIDTH ? (1u << (x_end - x)) - 1u : (1u << MCC_SIMD_WIDTH) - 1u;
+            for (size_t edge_i = 0; edge_i < 3; edge_i++) {
+                const struct occluder_edge *edge = &edges[edge_i];
+                const mcc_f32x8 values = mcc_f32x8_add(
+                    mcc_f32x8_splat(edge->a * ((float)x + 0.5f) + edge->b * ((float)y + 0.5f) + edge->c),
+                    edge_steps[edge_i]
+                );
+                mask &= mcc_f32x8_ge_mask(values, zero);
+            }
+            if (!mask)
+                continue;
+
+            const mcc_f32x8 depth = mcc_f32x8_min(max_depth, mcc_f32x8_add(
+                mcc_f32x8_splat(depth_offset + depth_dx * ((float)x + 0.5f - vs[0].x) + depth_dy * ((float)y + 0.5f - vs[0].y)),
+                depth_step
+            ));
+            if (mask == (1u << MCC_SIMD_WIDTH) - 1u) {
+                mcc_f32x8_store(&row[x], mcc_f32x8_min(mcc_f32x8_load(&row[x]), depth));
+                continue;
+            }
+            float depths[MCC_SIMD_WIDTH];
+            mcc_f32x8_store(depths, mcc_f32x8_min(mcc_f32x8_load(&row[x]), depth));
+            for (; mask; mask &= mask - 1) {
+                const uint32_t lane = stdc_trailing_zeros(mask);
+                row[x + lane] = depths[lane];
+            }
+        }
+    }
+}
+
+void mcc_occlusion_buffer_draw_occluders(
+    struct mcc_occlusion_buffer *r_buffer,
+    mcc_mat4f mvp,
+    enum mcc_cpurast_culling_mode culling_mode,
+    const mcc_vec3f *r_positions,
+    const uint32_t *r_indices, size_t index_count
+) {
+    assert(index_count % 3 == 0);
+    const float scale_x = 0.5f * (float)r_buffer->width,
+                scale_y = 0.5f * (float)r_buffer->height;
+
+    for (size_t index_i = 0; index_i < index_count; index_i += 3) {
+        struct occluder_vertex vs[3];
+        bool in_front = true;
+        for (size_t i = 0; i < 3; i++) {
+            const mcc_vec3f pos = r_positions[r_indices[index_i + i]];
+            const mcc_vec4f clip = mcc_mat4f_mul_vec4f(mvp, (mcc_vec4f){{ pos.x, pos.y, pos.z, 1.f }});
+            // Triangles are not clipped, only the ones fully in front of the
+            // near plane are drawn
+            if (!(clip.z >= -clip.w && clip.w > 0.f)) {
+                in_front = false;
+                break;
+            }
+            const float w_inv = 1.f / clip.w;
+            vs[i] = (struct occluder_vertex){
+                .x = ( clip.x * w_inv + 1.f) * scale_x,
+                .y = (-clip.y * w_inv + 1.f) * scale_y,
+                .depth = clip.z * w_inv,
+            };
+        }
+        if (in_front)
+            draw_occluder_triangle(r_buffer, vs, culling_mode);
+    }
+}
+
+bool mcc_occlusion_buffer_test_aabb(
+    const struct mcc_occlusion_buffer *r_buffer,
+    mcc_mat4f mvp,
+    mcc_vec3f min, mcc_vec3f max
+) {
+    static_assert(MCC_SIMD_WIDTH == 8);
+    // The 8 corners of the box
+    float corners[3][MCC_SIMD_WIDTH];
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++) {
+        corners[0][i] = i & 1 ? max.x : min.x;
+        corners[1][i] = i & 2 ? max.y : min.y;
+        corners[2][i] = i & 4 ? max.z : min.z;
+    }
+    float clip[4][MCC_SIMD_WIDTH];
+    mcc_mat4f_mul_points_soa(mvp, corners, clip);
+
+    // Outside of the view if all the corners are outside of the same plane
+    // of the clip volume
+    uint32_t outside_all = 0x3f;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++) {
+        const float x = clip[0][i], y = clip[1][i], z = clip[2][i], w = clip[3][i];
+        outside_all &= (x < -w ? 0x01u : 0u) | (x > w ? 0x02u : 0u)
+                     | (y < -w ? 0x04u : 0u) | (y > w ? 0x08u : 0u)
+                     | (z < -w ? 0x10u : 0u) | (z > w ? 0x20u : 0u);
+    }
+    if (outside_all)
+        return false;
+
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_depth = FLT_MAX,
+          max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++) {
+        // The box reaches the camera, its projection is unbounded
+        if (!(clip[2][i] >= -clip[3][i] && clip[3][i] > 0.f))
+            return true;
+        const float w_inv = 1.f / clip[3][i];
+        const float x = ( clip[0][i] * w_inv + 1.f) * 0.5f * (float)r_buffer->width,
+                    y = (-clip[1][i] * w_inv + 1.f) * 0.5f * (float)r_buffer->height;
+        min_x = fminf(min_x, x);
+        min_y = fminf(min_y, y);
+        max_x = fmaxf(max_x, x);
+        max_y = fmaxf(max_y, y);
+        min_depth = fminf(min_depth, clip[2][i] * w_inv);
+    }
+
+    // Every pixel touched by the bounds of the box
+    min_x = fmaxf(floorf(min_x), 0.f);
+    min_y = fmaxf(floorf(min_y), 0.f);
+    max_x = fminf(floorf(max_x) + 1.f, (float)r_buffer->width);
+    max_y = fminf(floorf(max_y) + 1.f, (float)r_buffer->height);
+    if (!(min_x < max_x && min_y < max_y) || min_depth > 1.f)
+        return false;
+    const uint32_t x_start = (uint32_t)min_x / MCC_SIMD_WIDTH * MCC_SIMD_WIDTH,
+                   x_min = (uint32_t)min_x,
+                   x_end = (uint32_t)max_x,
+                   y_start = (uint32_t)min_y,
+                   y_end = (uint32_t)max_y;
+
+    // Visible if the nearest point of the box is not behind the occluder of
+    // one of the pixels
+    const mcc_f32x8 box_depth = mcc_f32x8_splat(min_depth);
+    for (uint32_t y = y_start; y < y_end; y++) {
+        const float *row = &r_buffer->depth[(size_t)y * r_buffer->stride];
+        for (uint32_t x = x_start; x < x_end; x += MCC_SIMD_WIDTH) {
+            uint32_t mask = x_end - x < MCC_SIMD_WIDTH ? (1u << (x_end - x)) - 1u : (1u << MCC_SIMD_WIDTH) - 1u;
+            if (x < x_min)
+                mask &= ~((1u << (x_min - x)) - 1u);
+            if (mask & mcc_f32x8_ge_mask(mcc_f32x8_load(&row[x]), box_depth))
+                return true;
+        }
+    }
+    return false;
+}
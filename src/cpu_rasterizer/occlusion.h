@@ -0,0 +1,55 @@
+#pragma once
+
+#include "cpu_rasterizer/cpu_rasterizer.h"
+#include "linalg/matrix.h"
+#include "linalg/vector.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Low resolution depth buffer used to know, before rendering them, which
+ * objects are hidden behind occluders (big opaque surfaces drawn first).
+ *
+ * Occluders are written in the pixels whose center they cover with the
+ * depth of their farthest point, and bounding boxes are tested with the
+ * depth of their nearest point against all the pixels they touch. So an
+ * object reported as hidden is hidden, unless it is only visible through
+ * gaps between occluders smaller than a pixel of the buffer.
+ *
+ * Depths are normalized device coordinates, nearer is smaller (as with
+ * `mcc_depth_comparison_fn_lt`).
+ */
+struct mcc_occlusion_buffer;
+
+struct mcc_occlusion_buffer *mcc_occlusion_buffer_create(uint32_t width, uint32_t height);
+void mcc_occlusion_buffer_free(struct mcc_occlusion_buffer *o_buffer);
+
+/**
+ * Removes all occluders.
+ */
+void mcc_occlusion_buffer_clear(struct mcc_occlusion_buffer *r_buffer);
+
+/**
+ * Draws the given triangles (a triangle list indexing `r_positions`) as
+ * occluders, their positions being transformed by `mvp`.
+ * Triangles culled according to `culling_mode` (with the same convention as
+ * `mcc_cpurast_render`) and triangles crossing the near plane are ignored.
+ */
+void mcc_occlusion_buffer_draw_occluders(
+    struct mcc_occlusion_buffer *r_buffer,
+    mcc_mat4f mvp,
+    enum mcc_cpurast_culling_mode culling_mode,
+    const mcc_vec3f *r_positions,
+    const uint32_t *r_indices, size_t index_count
+);
+
+/**
+ * Returns false if the axis aligned box from `min` to `max`, transformed by
+ * `mvp`, is outside of the view or hidden behind the occluders.
+ */
+bool mcc_occlusion_buffer_test_aabb(
+    const struct mcc_occlusion_buffer *r_buffer,
+    mcc_mat4f mvp,
+    mcc_vec3f min, mcc_vec3f max
+);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "linalg/vector.h"
+#include "linalg/simd.h"
 
 typedef struct mcc_mat2f {
     mcc_vec2f r1;
@@ -193,6 +194,28 @@ static inline mcc_vec4f mcc_mat4f_mul_vec4f(mcc_mat4f mat, mcc_vec4f vec) {
     };
 }
 
+/**
+ * Same as `mcc_mat4f_mul_vec4f` with a w component of 1 but for
+ * MCC_SIMD_WIDTH points at once, in structure of arrays form (`r_points[0]`
+ * are the x components of all points, etc).
+ * Written with plain loops over the points so that they are vectorized.
+ */
+static inline void mcc_mat4f_mul_points_soa(
+    mcc_mat4f mat,
+    const float r_points[3][MCC_SIMD_WIDTH],
+    float r_out[4][MCC_SIMD_WIDTH]
+) {
+    mcc_mat4f t = mcc_mat4f_transpose(mat);
+    for (int row = 0; row < 4; row++) {
+        const float a = t.comps[row][0],
+                    b = t.comps[row][1],
+                    c = t.comps[row][2],
+                    d = t.comps[row][3];
+        for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+            r_out[row][i] = a * r_points[0][i] + b * r_points[1][i] + c * r_points[2][i] + d;
+    }
+}
+
 static inline mcc_mat4f mcc_mat4f_inverse(mcc_mat4f m) {
     float aug[4][8];
     int i, j, k;
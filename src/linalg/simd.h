@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+/**
+ * Number of lanes of the `mcc_f32x8` type.
+ */
+#define MCC_SIMD_WIDTH 8
+
+/**
+ * Eight floats processed together, backed by an AVX register when
+ * available, and by a plain array otherwise (which compilers are usually
+ * able to vectorize anyway).
+ */
+#ifdef __AVX__
+typedef __m256 mcc_f32x8;
+#else
+typedef struct {
+    float lanes[MCC_SIMD_WIDTH];
+} mcc_f32x8;
+#endif
+
+static inline mcc_f32x8 mcc_f32x8_splat(float val) {
+#ifdef __AVX__
+    return _mm256_set1_ps(val);
+#else
+    mcc_f32x8 result;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        result.lanes[i] = val;
+    return result;
+#endif
+}
+
+/**
+ * Returns { 0, 1, 2, 3, 4, 5, 6, 7 }
+ */
+static inline mcc_f32x8 mcc_f32x8_lane_indices() {
+#ifdef __AVX__
+    return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+#else
+    mcc_f32x8 result;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        result.lanes[i] = (float)i;
+    return result;
+#endif
+}
+
+/**
+ * `r_src` does not need to be aligned.
+ */
+static inline mcc_f32x8 mcc_f32x8_load(const float *r_src) {
+#ifdef __AVX__
+    return _mm256_loadu_ps(r_src);
+#else
+    mcc_f32x8 result;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        result.lanes[i] = r_src[i];
+    return result;
+#endif
+}
+
+/**
+ * `r_dst` does not need to be aligned.
+ */
+static inline void mcc_f32x8_store(float *r_dst, mcc_f32x8 val) {
+#ifdef __AVX__
+    _mm256_storeu_ps(r_dst, val);
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        r_dst[i] = val.lanes[i];
+#endif
+}
+
+static inline mcc_f32x8 mcc_f32x8_add(mcc_f32x8 lhs, mcc_f32x8 rhs) {
+#ifdef __AVX__
+    return _mm256_add_ps(lhs, rhs);
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        lhs.lanes[i] += rhs.lanes[i];
+    return lhs;
+#endif
+}
+
+static inline mcc_f32x8 mcc_f32x8_mul(mcc_f32x8 lhs, mcc_f32x8 rhs) {
+#ifdef __AVX__
+    return _mm256_mul_ps(lhs, rhs);
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        lhs.lanes[i] *= rhs.lanes[i];
+    return lhs;
+#endif
+}
+
+static inline mcc_f32x8 mcc_f32x8_min(mcc_f32x8 lhs, mcc_f32x8 rhs) {
+#ifdef __AVX__
+    return _mm256_min_ps(lhs, rhs);
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        lhs.lanes[i] = rhs.lanes[i] < lhs.lanes[i] ? rhs.lanes[i] : lhs.lanes[i];
+    return lhs;
+#endif
+}
+
+/**
+ * Only writes the lanes whose bit is set in `mask` to `r_dst`, which does
+ * not need to be aligned.
+ */
+static inline void mcc_f32x8_masked_store(float *r_dst, mcc_f32x8 val, uint32_t mask) {
+#ifdef __AVX2__
+    const __m256i lane_bits = _mm256_setr_epi32(1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7);
+    const __m256i lane_mask = _mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32((int)mask), lane_bits), lane_bits
+    );
+    _mm256_maskstore_ps(r_dst, lane_mask, val);
+#else
+    float lanes[MCC_SIMD_WIDTH];
+    mcc_f32x8_store(lanes, val);
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++) {
+        if (mask & (1u << i))
+            r_dst[i] = lanes[i];
+    }
+#endif
+}
+
+/**
+ * Returns a bitmask with the nth bit set if `lhs[n] >= rhs[n]`
+ */
+static inline uint32_t mcc_f32x8_ge_mask(mcc_f32x8 lhs, mcc_f32x8 rhs) {
+#ifdef __AVX__
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_GE_OQ));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        mask |= (lhs.lanes[i] >= rhs.lanes[i] ? 1u : 0u) << i;
+    return mask;
+#endif
+}
+
+/**
+ * Eight 64 bits integers processed together, backed by two AVX2 registers
+ * when available, and by a plain array otherwise.
+ */
+#ifdef __AVX2__
+typedef struct {
+    __m256i lo;
+    __m256i hi;
+} mcc_i64x8;
+#else
+typedef struct {
+    int64_t lanes[MCC_SIMD_WIDTH];
+} mcc_i64x8;
+#endif
+
+static inline mcc_i64x8 mcc_i64x8_splat(int64_t val) {
+#ifdef __AVX2__
+    return (mcc_i64x8){ _mm256_set1_epi64x(val), _mm256_set1_epi64x(val) };
+#else
+    mcc_i64x8 result;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        result.lanes[i] = val;
+    return result;
+#endif
+}
+
+/**
+ * Returns { 0, val, 2 * val, ..., 7 * val }
+ */
+static inline mcc_i64x8 mcc_i64x8_lane_multiples(int64_t val) {
+#ifdef __AVX2__
+    return (mcc_i64x8){
+        _mm256_setr_epi64x(0 * val, 1 * val, 2 * val, 3 * val),
+        _mm256_setr_epi64x(4 * val, 5 * val, 6 * val, 7 * val),
+    };
+#else
+    mcc_i64x8 result;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        result.lanes[i] = i * val;
+    return result;
+#endif
+}
+
+/**
+ * `r_dst` does not need to be aligned.
+ */
+static inline void mcc_i64x8_store(int64_t *r_dst, mcc_i64x8 val) {
+#ifdef __AVX2__
+    _mm256_storeu_si256((__m256i*)&r_dst[0], val.lo);
+    _mm256_storeu_si256((__m256i*)&r_dst[4], val.hi);
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        r_dst[i] = val.lanes[i];
+#endif
+}
+
+static inline mcc_i64x8 mcc_i64x8_add(mcc_i64x8 lhs, mcc_i64x8 rhs) {
+#ifdef __AVX2__
+    return (mcc_i64x8){ _mm256_add_epi64(lhs.lo, rhs.lo), _mm256_add_epi64(lhs.hi, rhs.hi) };
+#else
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        lhs.lanes[i] += rhs.lanes[i];
+    return lhs;
+#endif
+}
+
+/**
+ * Returns a bitmask with the nth bit set if `lhs[n] > rhs[n]`
+ */
+static inline uint32_t mcc_i64x8_gt_mask(mcc_i64x8 lhs, mcc_i64x8 rhs) {
+#ifdef __AVX2__
+    uint32_t lo = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lhs.lo, rhs.lo)));
+    uint32_t hi = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lhs.hi, rhs.hi)));
+    return lo | (hi << 4);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < MCC_SIMD_WIDTH; i++)
+        mask |= (lhs.lanes[i] > rhs.lanes[i] ? 1u : 0u) << i;
+    return mask;
+#endif
+}
+
+/**
+ * Sets the `count` elements of `r_dst` to `val`, with non temporal stores
+ * (bypassing the caches) when available, for buffers too big to stay in the
+ * caches anyway.
+ */
+static inline void mcc_f32_stream_fill(float *r_dst, size_t count, float val) {
+#ifdef __AVX__
+    size_t i = 0;
+    // Non temporal stores must be aligned
+    for (; i < count && (uintptr_t)&r_dst[i] % sizeof(__m256) != 0; i++)
+        r_dst[i] = val;
+    const __m256 vals = _mm256_set1_ps(val);
+    for (; i + MCC_SIMD_WIDTH <= count; i += MCC_SIMD_WIDTH)
+        _mm256_stream_ps(&r_dst[i], vals);
+    for (; i < count; i++)
+        r_dst[i] = val;
+    // Non temporal stores are not ordered with the other stores
+    _mm_sfence();
+#else
+    for (size_t i = 0; i < count; i++)
+        r_dst[i] = val;
+#endif
+}
+
+/**
+ * Same as `mcc_f32_stream_fill` for 32 bits integers.
+ */
+static inline void mcc_u32_stream_fill(uint32_t *r_dst, size_t count, uint32_t val) {
+#ifdef __AVX__
+    size_t i = 0;
+    for (; i < count && (uintptr_t)&r_dst[i] % sizeof(__m256i) != 0; i++)
+        r_dst[i] = val;
+    const __m256i vals = _mm256_set1_epi32((int)val);
+    for (; i + MCC_SIMD_WIDTH <= count; i += MCC_SIMD_WIDTH)
+        _mm256_stream_si256((__m256i*)&r_dst[i], vals);
+    for (; i < count; i++)
+        r_dst[i] = val;
+    _mm_sfence();
+#else
+    for (size_t i = 0; i < count; i++)
+        r_dst[i] = val;
+#endif
+}
@@ -7,11 +7,15 @@
 #include "chunk/chunk.h"
 #include "chunk/triangulate.h"
 #include "chunk/shader.h"
+#include "chunk/occlusion.h"
+#include "cpu_rasterizer/occlusion.h"
+#include "utils.h"
 
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -22,6 +26,25 @@
 #define KEY_UP 111
 #define KEY_DOWN 116
 
+/**
+ * With temporal rendering, number of frames after which a frame is fully
+ * rendered instead of being reprojected from the previous one.
+ */
+#define TEMPORAL_REFRESH_INTERVAL 8
+
+/**
+ * Number of chunks rendered along the x and z axes, the camera starting in
+ * the first one.
+ */
+#define CHUNK_GRID_SIZE 3
+#define CHUNK_COUNT (CHUNK_GRID_SIZE * CHUNK_GRID_SIZE)
+
+/**
+ * Width and height (in pixels of the window) of a pixel of the occlusion
+ * buffer.
+ */
+#define OCCLUSION_BUFFER_SCALE 4
+
 static inline long long diff_ns(struct timespec start,
                                 struct timespec end)
 {
@@ -29,6 +52,76 @@ static inline long long diff_ns(struct timespec start,
          + (end.tv_nsec - start.tv_nsec);
 }
 
+/**
+ * Attachments of a rendered frame, kept so that the next frame can be
+ * reprojected from it.
+ */
+struct frame {
+    uint8_t *color_data;
+    float32_t *depth_data;
+    float32_t *coarse_depth_data;
+    uint8_t *lazy_clear_tiles;
+    /**
+     * Tiles to render when the frame is reprojected.
+     */
+    uint8_t *tile_mask;
+
+    struct mcc_cpurast_rendering_color_attachment color;
+    struct mcc_cpurast_rendering_depth_attachment depth;
+    struct mcc_cpurast_lazy_clear lazy_clear;
+    struct mcc_cpurast_rendering_attachment attachment;
+
+    /**
+     * True if the attachments hold the frame rendered with
+     * `view_projection`, with no pending lazy clear.
+     */
+    bool reusable;
+    mcc_mat4f view_projection;
+};
+
+static void frame_free(struct frame *r_frame) {
+    free(r_frame->color_data);
+    free(r_frame->depth_data);
+    free(r_frame->coarse_depth_data);
+    free(r_frame->lazy_clear_tiles);
+    free(r_frame->tile_mask);
+    *r_frame = (struct frame){};
+}
+
+/**
+ * (Re)allocates the attachments of the frame if it does not have the given
+ * size and layout.
+ */
+static void frame_resize(struct frame *r_frame, uint32_t width, uint32_t height, enum mcc_cpurast_attachment_layout layout) {
+    if (r_frame->color_data && r_frame->attachment.width == width
+        && r_frame->attachment.height == height && r_frame->attachment.layout == layout)
+        return;
+    frame_free(r_frame);
+
+    const size_t pixel_count = mcc_cpurast_attachment_pixel_count(width, height, layout);
+    const size_t tile_count = mcc_cpurast_lazy_clear_tile_count(width, height);
+    r_frame->color_data = malloc(pixel_count * sizeof(*r_frame->color_data) * 4);
+    r_frame->depth_data = malloc(pixel_count * sizeof(*r_frame->depth_data));
+    r_frame->coarse_depth_data = malloc(mcc_cpurast_coarse_depth_size(width, height) * sizeof(*r_frame->coarse_depth_data));
+    r_frame->lazy_clear_tiles = calloc(tile_count, sizeof(*r_frame->lazy_clear_tiles));
+    r_frame->tile_mask = malloc(tile_count * sizeof(*r_frame->tile_mask));
+
+    r_frame->color = (struct mcc_cpurast_rendering_color_attachment){ .r_data = r_frame->color_data, };
+    r_frame->depth = (struct mcc_cpurast_rendering_depth_attachment){
+        .r_data = r_frame->depth_data,
+        .o_coarse_data = r_frame->coarse_depth_data,
+    };
+    r_frame->lazy_clear = (struct mcc_cpurast_lazy_clear){ .r_tiles = r_frame->lazy_clear_tiles, };
+    r_frame->attachment = (struct mcc_cpurast_rendering_attachment){
+        .o_depth = &r_frame->depth,
+        .o_color = &r_frame->color,
+        .o_lazy_clear = &r_frame->lazy_clear,
+        .width = width,
+        .height = height,
+        .layout = layout,
+    };
+}
+
 int main() {
     struct mcc_window *window = mcc_window_create((struct mcc_create_window_cfg){
         .title = "MCC Chunk Viewer",
@@ -40,43 +133,68 @@ int main() {
 
     mcc_window_open(window);
 
-    // Generate a chunk with seed 0
-    struct mcc_chunk_data chunk_data = {
-        .x = 0,
-        .y = 0,
-        .z = 0
-    };
+    // Generate a grid of chunks with seed 0, and a mesh for each of them
+    struct mcc_chunk_mesh chunk_meshes[CHUNK_COUNT];
+    // Model transformation of each chunk, its meshes being in its local
+    // coordinates
+    mcc_mat4f chunk_models[CHUNK_COUNT];
     {
-        struct timespec generate_start, generate_end;
-        timespec_get(&generate_start, TIME_UTC);
-        mcc_chunk_generate(0, &chunk_data);
-        timespec_get(&generate_end, TIME_UTC);
-        printf("Generated chunk in %fms\n", (double)diff_ns(generate_start, generate_end) / 1'000'000.);
+        struct mcc_chunk_data chunk_data;
+        long long generate_ns = 0, mesh_ns = 0;
+        size_t vertex_count = 0, index_count = 0;
+        for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++) {
+            chunk_data.x = chunk_i % CHUNK_GRID_SIZE;
+            chunk_data.y = 0;
+            chunk_data.z = chunk_i / CHUNK_GRID_SIZE;
+            chunk_models[chunk_i] = mcc_mat4f_translate((mcc_vec3f){{
+                (float)(chunk_data.x * MCC_CHUNK_WIDTH),
+                (float)(chunk_data.y * MCC_CHUNK_WIDTH),
+                (float)(chunk_data.z * MCC_CHUNK_WIDTH),
+            }});
+
+            struct timespec generate_start, generate_end, mesh_end;
+            timespec_get(&generate_start, TIME_UTC);
+            mcc_chunk_generate(0, &chunk_data);
+            timespec_get(&generate_end, TIME_UTC);
+            mcc_chunk_mesh_init(&chunk_meshes[chunk_i]);
+            mcc_chunk_mesh_create(&chunk_meshes[chunk_i], &chunk_data);
+            timespec_get(&mesh_end, TIME_UTC);
+
+            generate_ns += diff_ns(generate_start, generate_end);
+            mesh_ns += diff_ns(generate_end, mesh_end);
+            vertex_count += chunk_meshes[chunk_i].vertex_count;
+            index_count += chunk_meshes[chunk_i].index_count;
+        }
+        printf("Generated %d chunks in %fms\n", CHUNK_COUNT, (double)generate_ns / 1'000'000.);
+        printf("Meshed %d chunks in %fms\n", CHUNK_COUNT, (double)mesh_ns / 1'000'000.);
+        printf("Generated chunk meshes with %zu vertices and %zu indices\n", vertex_count, index_count);
     }
-    
-    // Create a mesh from the chunk data
-    struct mcc_chunk_mesh chunk_mesh;
-    mcc_chunk_mesh_init(&chunk_mesh);
-    {
-        struct timespec mesh_start, mesh_end;
-        timespec_get(&mesh_start, TIME_UTC);
-        mcc_chunk_mesh_create(&chunk_mesh, &chunk_data);
-        timespec_get(&mesh_end, TIME_UTC);
-        printf("Meshed chunk in %fms\n", (double)diff_ns(mesh_start, mesh_end) / 1'000'000.);
+
+    // Render objects to pass to shader
+    struct mcc_chunk_render_data *render_data = mcc_chunk_render_data_load();
+    struct mcc_chunk_render_object render_objects[CHUNK_COUNT];
+    for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++) {
+        render_objects[chunk_i] = (struct mcc_chunk_render_object){
+            .data = render_data,
+            .mesh = &chunk_meshes[chunk_i],
+            .mvp = mcc_mat4f_identity() // Initial MVP, will be updated each frame
+        };
     }
-    
-    printf("Generated chunk mesh with %zu vertices\n", chunk_mesh.vertex_count);
-    
-    // Render object to pass to shader
-    struct mcc_chunk_render_object render_object = {
-        .data = mcc_chunk_render_data_load(),
-        .mesh = &chunk_mesh,
-        .mvp = mcc_mat4f_identity() // Initial MVP, will be updated each frame
-    };
+
+    // Reused by all renders so that its buffers are only allocated once
+    struct mcc_cpurast_context *render_context = mcc_cpurast_context_create();
+    // The draws of the chunks that are not hidden
+    struct mcc_cpurast_command_buffer *command_buffer = mcc_cpurast_command_buffer_create();
+
+    // Recreated at a fraction of the window's size when it is resized
+    struct mcc_occlusion_buffer *occlusion_buffer = NULL;
+    uint32_t occlusion_width = 0, occlusion_height = 0;
 
     struct mcc_cpurast_clear_config clear_config = {
         .clear_depth = 1.0f,
         .clear_color = { 0.4f, 0.6f, 0.9f, 1.0f }, // Sky blue
+        // Tiles are cleared by the rasterization tasks
+        .lazy = true,
     };
 
     // Camera control variables
@@ -86,10 +204,18 @@ int main() {
     const float rotation_delta = 0.1f;
 
     bool enable_wireframe = false,
-         enable_depth_rendering = false;
+         enable_depth_rendering = false,
+         enable_temporal = false;
+    enum mcc_cpurast_shading_mode shading_mode = MCC_CPURAST_SHADING_MODE_FORWARD;
 
     mcc_vec3f camera_pos = {{ 4.5f, 5.5f, 4.5f }};
 
+    // Rendered to one after the other, so that the previous frame can be
+    // reprojected to the current one
+    struct frame frames[2] = {};
+    uint32_t frame_idx = 0;
+    uint32_t frames_since_refresh = 0;
+
     for (bool close = false; !close;) {
         union mcc_window_event event = mcc_window_wait_next_event(window);
         bool need_redraw = false;
@@ -116,10 +242,19 @@ int main() {
                 need_redraw = true;
             } else if (event.key_press.keycode == 25 /* 'w' */) {
                 enable_wireframe = !enable_wireframe;
+                // The previous frames no longer look like the next ones
+                frames[0].reusable = frames[1].reusable = false;
                 need_redraw = true;
             } else if (event.key_press.keycode == 40 /* 'd' */) {
                 enable_depth_rendering = !enable_depth_rendering;
                 need_redraw = true;
+            } else if (event.key_press.keycode == 55 /* 'v' */) {
+                // Forward, then deferred, then depth prepass
+                shading_mode = (enum mcc_cpurast_shading_mode)((shading_mode + 1) % (MCC_CPURAST_SHADING_MODE_DEPTH_PREPASS + 1));
+                need_redraw = true;
+            } else if (event.key_press.keycode == 28 /* 't' */) {
+                enable_temporal = !enable_temporal;
+                printf("Temporal reprojection %s\n", enable_temporal ? "enabled" : "disabled");
             }
             break;
         case MCC_WINDOW_EVENT_KEY_RELEASE:
@@ -166,70 +301,159 @@ int main() {
                 MCC_PIf / 2.0f
             );
 
-            render_object.mvp = mcc_mat4f_mul(projection, mcc_mat4f_mul(view, model));
+            const mcc_mat4f view_projection = mcc_mat4f_mul(projection, view);
+            for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++)
+                render_objects[chunk_i].mvp = mcc_mat4f_mul(view_projection, mcc_mat4f_mul(chunk_models[chunk_i], model));
 
             /*
              * Allocate image and depth buffers
              */
+            // Rendered in blocks, resolved to a linear image for the window
+            const enum mcc_cpurast_attachment_layout layout = MCC_CPURAST_ATTACHMENT_LAYOUT_BLOCKED;
+            const size_t pixel_count = mcc_cpurast_attachment_pixel_count(safe_to_u32(width), safe_to_u32(height), layout);
             uint8_t *image_data = malloc(width * height * sizeof(*image_data) * 4);
-            float32_t *depth_data = malloc(width * height * sizeof(*depth_data));
-            struct mcc_cpurast_rendering_attachment attachment = {
-                .o_depth = &(struct mcc_cpurast_rendering_depth_attachment) { .r_data = depth_data },
-                .o_color = &(struct mcc_cpurast_rendering_color_attachment) { .r_data = image_data, },
-                .width = safe_to_u32(width),
-                .height = safe_to_u32(height),
-            };
-            
-            // Setup render configuration using our chunk shaders
-            struct mcc_cpurast_render_config render_config;
-            mcc_chunk_render_config(
-                &render_config,
-                &render_object,
-                &attachment
-            );
+            struct frame *frame = &frames[frame_idx],
+                         *previous_frame = &frames[1 - frame_idx];
+            frame_resize(frame, safe_to_u32(width), safe_to_u32(height), layout);
+            struct mcc_cpurast_rendering_attachment *attachment = &frame->attachment;
 
-            if (enable_wireframe) {
-                render_config.culling_mode = MCC_CPURAST_CULLING_MODE_NONE;
-                render_config.polygon_mode = MCC_CPURAST_POLYGON_MODE_LINE;
+            /*
+             * Find the chunks hidden behind the others
+             */
+            const uint32_t new_occlusion_width = mcc_up_div(safe_to_u32(width), OCCLUSION_BUFFER_SCALE),
+                           new_occlusion_height = mcc_up_div(safe_to_u32(height), OCCLUSION_BUFFER_SCALE);
+            if (!occlusion_buffer || occlusion_width != new_occlusion_width || occlusion_height != new_occlusion_height) {
+                mcc_occlusion_buffer_free(occlusion_buffer);
+                occlusion_width = new_occlusion_width;
+                occlusion_height = new_occlusion_height;
+                occlusion_buffer = mcc_occlusion_buffer_create(occlusion_width, occlusion_height);
+            }
+            mcc_occlusion_buffer_clear(occlusion_buffer);
+            // Hidden chunks can be seen through the wireframe, only the
+            // chunks outside of the view are skipped then
+            if (!enable_wireframe) {
+                for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++)
+                    mcc_chunk_draw_occluders(occlusion_buffer, &render_objects[chunk_i]);
+            }
+
+            // Setup render configuration using our chunk shaders, for each
+            // visible chunk
+            struct mcc_cpurast_render_config render_configs[CHUNK_COUNT];
+            size_t drawn_chunk_count = 0;
+            struct mcc_cpurast_pipeline_statistics statistics = {};
+            for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++) {
+                if (!mcc_chunk_test_visibility(occlusion_buffer, &render_objects[chunk_i]))
+                    continue;
+
+                struct mcc_cpurast_render_config *render_config = &render_configs[drawn_chunk_count++];
+                mcc_chunk_render_config(
+                    render_config,
+                    &render_objects[chunk_i],
+                    attachment
+                );
+                render_config->o_context = render_context;
+
+                if (enable_wireframe) {
+                    render_config->culling_mode = MCC_CPURAST_CULLING_MODE_NONE;
+                    render_config->polygon_mode = MCC_CPURAST_POLYGON_MODE_LINE;
+                }
+                render_config->shading_mode = shading_mode;
+                // Shared by all draws, which sums their statistics
+                render_config->o_statistics = &statistics;
             }
-            
-            clear_config.r_attachment = &attachment;
 
-            // Render the chunk
+            clear_config.r_attachment = attachment;
             mcc_cpurast_clear(&clear_config);
-            mcc_cpurast_render(&render_config);
+
+            // Reuse the previous frame where possible, only rendering the
+            // tiles it does not cover
+            const bool reproject = enable_temporal && !enable_depth_rendering && previous_frame->reusable
+                && previous_frame->attachment.width == attachment->width
+                && previous_frame->attachment.height == attachment->height
+                && frames_since_refresh + 1 < TEMPORAL_REFRESH_INTERVAL;
+            size_t rendered_tile_count = mcc_cpurast_lazy_clear_tile_count(attachment->width, attachment->height);
+            if (reproject) {
+                rendered_tile_count = mcc_cpurast_reproject(&(struct mcc_cpurast_reproject_config){
+                    .r_previous_attachment = &previous_frame->attachment,
+                    .previous_view_projection = previous_frame->view_projection,
+                    .r_attachment = attachment,
+                    .view_projection = view_projection,
+                    .r_out_tile_mask = frame->tile_mask,
+                });
+                for (size_t config_i = 0; config_i < drawn_chunk_count; config_i++)
+                    render_configs[config_i].o_tile_mask = frame->tile_mask;
+                frames_since_refresh++;
+            } else {
+                frames_since_refresh = 0;
+            }
+
+            // Render the chunks
+            mcc_cpurast_command_buffer_reset(command_buffer);
+            for (size_t config_i = 0; config_i < drawn_chunk_count; config_i++)
+                mcc_cpurast_command_buffer_draw(command_buffer, &render_configs[config_i]);
+            mcc_cpurast_command_buffer_submit(command_buffer, render_context);
+
+            // The depth rendering overwrites the colors
+            frame->reusable = enable_temporal && !enable_depth_rendering;
+            frame->view_projection = view_projection;
+            if (frame->reusable)
+                mcc_cpurast_finish_clear(attachment);
+            frame_idx = 1 - frame_idx;
 
             if (enable_depth_rendering) {
+                mcc_cpurast_finish_clear(attachment);
+                float32_t *depth_data = frame->depth_data;
+                uint8_t *color_data = frame->color_data;
+                // Both attachments have the same layout
                 float max_depth = -1.f, min_depth = 1.f;
-                for (size_t i = 0; i < width*height; i++) {
+                for (size_t i = 0; i < pixel_count; i++) {
                     if (depth_data[i] > max_depth)
                         max_depth = depth_data[i];
                     if (depth_data[i] < min_depth)
                         min_depth = depth_data[i];
                 }
-                for (size_t i = 0; i < width*height; i++) {
+                for (size_t i = 0; i < pixel_count; i++) {
                     uint8_t p = 255 - (uint8_t)(((depth_data[i] - min_depth) / (max_depth - min_depth)) * 255.f);
-                    memset(image_data + i*4, p, 4);
+                    memset(color_data + i*4, p, 4);
                 }
             }
+            mcc_cpurast_resolve_color(attachment, image_data);
 
             mcc_window_put_image(window, image_data, geometry.width, geometry.height);
 
             // Clean up resources
-            mcc_chunk_render_config_cleanup(&render_config);
+            for (size_t config_i = 0; config_i < drawn_chunk_count; config_i++)
+                mcc_chunk_render_config_cleanup(&render_configs[config_i]);
             free(image_data);
-            free(depth_data);
 
             timespec_get(&render_end, TIME_UTC);
             printf("Finished rendering (took %fms)!\n", (double)diff_ns(render_start, render_end) / 1'000'000.);
+            printf(
+                "  %" PRIu64 " vertices shaded, %" PRIu64 " triangles (%" PRIu64 " culled, %" PRIu64 " clipped, %" PRIu64 " rasterized)\n"
+                "  %" PRIu64 " fragments depth tested, %" PRIu64 " passed, %" PRIu64 " shaded\n"
+                "  %zu of %d chunks drawn, %zu tiles rendered%s\n",
+                statistics.vertex_shader_invocations,
+                statistics.input_triangles, statistics.culled_triangles,
+                statistics.clipped_triangles, statistics.rasterized_triangles,
+                statistics.depth_tested_fragments, statistics.samples_passed,
+                statistics.fragment_shader_invocations,
+                drawn_chunk_count, CHUNK_COUNT,
+                rendered_tile_count, reproject ? " (reprojected)" : ""
+            );
         }
     }
 
     // Clean up
-    mcc_chunk_mesh_free(&chunk_mesh);
+    frame_free(&frames[0]);
+    frame_free(&frames[1]);
+    mcc_occlusion_buffer_free(occlusion_buffer);
+    mcc_cpurast_command_buffer_free(command_buffer);
+    mcc_cpurast_context_free(render_context);
+    for (size_t chunk_i = 0; chunk_i < CHUNK_COUNT; chunk_i++)
+        mcc_chunk_mesh_free(&chunk_meshes[chunk_i]);
     mcc_window_free(window);
 
-    mcc_chunk_render_data_free(render_object.data);
+    mcc_chunk_render_data_free(render_data);
 
     printf("Bye!\n");
 